@@ -31,5 +31,14 @@ namespace Interfaces
         /// <param name="data"></param>
         /// <returns></returns>
         int ReadMmcDevice(ref byte[] data);
+
+        /// <summary>
+        /// Write an opcode block & read its response as one operation,
+        /// nothing else using the device can get between the two
+        /// </summary>
+        /// <param name="opcodes"></param>
+        /// <param name="response"></param>
+        /// <returns>0 on success, else Windows error code</returns>
+        int TransferMmcDevice(byte[] opcodes, ref byte[] response);
     }
 }
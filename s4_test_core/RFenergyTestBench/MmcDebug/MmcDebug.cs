@@ -1,37 +1,63 @@
 ﻿
 using System;
 using System.Runtime.InteropServices;
+using System.Text;
 using Interfaces;
 
 namespace MmcDebug
 {
     public class MmcDebug : IMmc
     {
-        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl, CharSet=CharSet.Ansi)]
-        static extern int OpenMmc([MarshalAs(UnmanagedType.LPStr)]string deviceName, ref IntPtr hMmcDevice);
+        // Version 2 ABI, every argument is blittable so byte[] buffers are
+        // pinned and passed straight through rather than copied.
+        const int MmcAbiVersionExpected = 2;
 
-        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
-        static extern int CloseMmc(IntPtr hDevice);
+        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int MmcAbiVersion();
 
         [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
-        static extern int WriteMmc(IntPtr hMmc, [MarshalAs(UnmanagedType.LPArray)]byte[] data, int bytes);
+        static extern int MmcOpen([MarshalAs(UnmanagedType.LPStr)]string deviceName, out ulong hMmc);
 
-        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
-        static extern int ReadMmc(IntPtr hDevice, [MarshalAs(UnmanagedType.LPArray, SizeParamIndex=2)]ref byte[] data, int bytes);
+        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int MmcClose(ulong hMmc);
 
-        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
-        [return: MarshalAs(UnmanagedType.LPStr)]
-        static extern string GetMmcStatus();
+        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int MmcWrite(ulong hMmc, byte[] data, int bytes);
+
+        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int MmcRead(ulong hMmc, byte[] data, int bytes, out int bytesRead);
 
-        IntPtr _hmmc;
+        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int MmcTransfer(ulong hMmc, byte[] opcodes, int writeBytes, byte[] response, int readBytes);
+
+        [DllImport("mmc_io.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int MmcGetStatus(ulong hMmc, byte[] status, int bytes);
+
+        const int MaxStatusBytes = 512;
+
+        ulong _hmmc;
         string _lastStatus;
+        byte[] _statusBuffer = new byte[MaxStatusBytes];
+
+        string GetMmcStatus()
+        {
+            MmcGetStatus(_hmmc, _statusBuffer, _statusBuffer.Length);
+            int length = Array.IndexOf(_statusBuffer, (byte)0);
+            return Encoding.ASCII.GetString(_statusBuffer, 0, length < 0 ? _statusBuffer.Length : length);
+        }
 
         public int OpenMmcDevice(string mmcDevice)
         {
             try
             {
-                _hmmc = new IntPtr(0);
-                int status = OpenMmc(mmcDevice, ref _hmmc);
+                if (MmcAbiVersion() != MmcAbiVersionExpected)
+                {
+                    _lastStatus = string.Format("mmc_io.dll ABI version {0}, expected {1}.", MmcAbiVersion(), MmcAbiVersionExpected);
+                    return 120;  // ERROR_CALL_NOT_IMPLEMENTED
+                }
+
+                _hmmc = 0;
+                int status = MmcOpen(mmcDevice, out _hmmc);
                 _lastStatus = GetMmcStatus();
                 return status;
             }
@@ -45,12 +71,11 @@ namespace MmcDebug
         {
             try
             {
-                if(_hmmc != null && _hmmc.ToInt32() != 0)
+                if(_hmmc != 0)
                 {
-                    int status = CloseMmc(_hmmc);
+                    int status = MmcClose(_hmmc);
+                    _hmmc = 0;
                     _lastStatus = GetMmcStatus();
-                    if (status == 0)
-                        _hmmc = new IntPtr(0);
                     return status;
                 }
                 return 0;
@@ -67,7 +92,8 @@ namespace MmcDebug
             {
                 if (data == null)
                     data = new byte[1024];
-                int status = ReadMmc(_hmmc, ref data, data.Length);
+                int bytesRead;
+                int status = MmcRead(_hmmc, data, data.Length, out bytesRead);
                 _lastStatus = GetMmcStatus();
                 Array.Copy(data, 512, data, 0, 512);
                 return status;
@@ -88,7 +114,7 @@ namespace MmcDebug
                     return 87;  // INVALID_PARAMETER
                 }
 
-                int status = WriteMmc(_hmmc, opcodes, opcodes.Length);
+                int status = MmcWrite(_hmmc, opcodes, opcodes.Length);
                 _lastStatus = GetMmcStatus();
                 return status;
             }
@@ -98,6 +124,29 @@ namespace MmcDebug
             }
         }
 
+        public int TransferMmcDevice(byte[] opcodes, ref byte[] response)
+        {
+            try
+            {
+                if (opcodes.Length == 0 || opcodes.Length % 512 != 0)
+                {
+                    _lastStatus = "Opcode block must be integral multiple of 512 bytes.";
+                    return 87;  // INVALID_PARAMETER
+                }
+
+                if (response == null)
+                    response = new byte[1024];
+                int status = MmcTransfer(_hmmc, opcodes, opcodes.Length, response, response.Length);
+                _lastStatus = GetMmcStatus();
+                Array.Copy(response, 512, response, 0, 512);
+                return status;
+            }
+            catch (Exception ex)
+            {
+                throw new ApplicationException("Exception transferring MMC opcodes", ex);
+            }
+        }
+
         public int GetLastMmcStatus(ref string status)
         {
             try
@@ -99,12 +99,9 @@ namespace MmcTestModule
             // Offset opcodes to sector 2
             byte[] cmd = new byte[Opcodes.OPCODE_BLOCK * 2];
             Array.Copy(command, 0, cmd, 512, command.Length);
-            int status, s2;
-            status = _mmc.WriteMmcDevice(cmd);
-            s2 = _mmc.ReadMmcDevice(ref response);
-            if (status == 0)
-                status = s2;
-            return status;
+            // One transfer so a native scheduler or leveler on the same
+            // device can't get its block in between our write & read
+            return _mmc.TransferMmcDevice(cmd, ref response);
         }
 
         public override int WrRdSPI(int device, ref byte[] data)
@@ -0,0 +1,390 @@
+//
+// leveler.cpp : Native closed-loop power leveling, see leveler.h
+//
+#include "stdafx.h"
+#include "leveler.h"
+#include "scheduler.h"
+#include "zmon.h"
+
+#include <malloc.h>
+#include <map>
+#include <math.h>
+#include <mmsystem.h>
+
+// Opcodes & status, from the FPGA opcodes.h, opcodes.v & status.h
+#define op_power 0x03
+#define op_pulse 0x05
+#define op_meas_zmsize 0x30
+#define op_meas_zmctl 0x31
+#define op_meas 0x32
+#define meas_volts (1 << 2)
+#define zmctl_clear (1 << 0)                // empty the MEAS fifo
+#define zmctl_enable (1 << 1)               // measure during pulses, cleared if not set
+#define rsp_success 0x01
+
+// PULSE opcode data as pulse.v reads it: [7:0] channel, [31:8] width in
+// 100ns ticks, [32] measure flag, [63:39] 1-based tick to measure at
+#define pulse_ticks_per_us 10
+#define pulse_max_ticks 0xffffff
+#define pulse_measure (1ULL << 32)
+#define pulse_width_shift 8
+#define pulse_measure_at_shift 39
+
+// Same framing as the managed RunCmd(), opcodes in the 2nd sector & the
+// response header (status, opcode, length lsb, length msb) in the 2nd sector
+#define level_block_bytes 1024
+#define level_opcode_offset 512
+#define level_rsp_offset 512
+#define level_rsp_header 4
+#define level_volts_bytes 16                // FWDI, FWDQ, RFLI, RFLQ, Q15.16 each
+
+#define level_meas_timeout_us 2000          // for the last reading after the pulses end
+
+#define level_min_slope 0.1f                // secant slopes outside these are
+#define level_max_slope 10.0f               // noise, fall back to unity gain
+
+typedef std::pair<int, unsigned int> LevelKey;   // channel, frequency
+
+// Last converged point at a channel & frequency
+typedef struct LevelPoint
+{
+	float setting;
+	float measuredDbm;
+	float slope;                        // dB out per dB of POWER around that point
+} LevelPoint;
+
+static std::map<LevelKey, LevelPoint> _warm;
+static SRWLOCK _warmLock = SRWLOCK_INIT;
+
+// Clear the command block & start a single opcode in its 2nd sector
+static BYTE *put_opcode(BYTE *cmd, int opcode, int length)
+{
+	memset(cmd, 0, level_block_bytes);
+	BYTE *op = cmd + level_opcode_offset;
+	unsigned short tmp = (unsigned short)((opcode << 9) | length);
+	op[0] = (BYTE)(tmp & 0xff);
+	op[1] = (BYTE)(tmp >> 8);
+	return op;
+}
+
+static int get_int(const BYTE *p)
+{
+	return (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+}
+
+static float clamp_setting(const LevelConfig *config, float setting)
+{
+	if (setting < config->minSetting)
+		return config->minSetting;
+	if (setting > config->maxSetting)
+		return config->maxSetting;
+	return setting;
+}
+
+/*
+	Send the opcode block in cmd & read its response into rsp.
+
+	Returns: 0 if the opcode status is SUCCESS, else Windows error code
+*/
+static DWORD level_opcode(MmcDevice *d, const char *name, const BYTE *cmd, BYTE *rsp)
+{
+	DWORD err = mmc_transfer(d, cmd, level_block_bytes, rsp, level_block_bytes);
+	if (err != 0)
+		return err;
+	if (rsp[level_rsp_offset] != rsp_success)
+	{
+		mmc_status(d, "Error, %s opcode status 0x%02x.", name, rsp[level_rsp_offset]);
+		return ERROR_INVALID_FUNCTION;
+	}
+	return 0;
+}
+
+/*
+	Send POWER, empty the MEAS fifo, wait settleUs, then fire measCount
+	measured PULSEs & read back the volts readings MEAS_ZMSIZE says are
+	there. The caller holds the device lock.
+	*dbm is the forward power of the averaged readings.
+
+	Returns: 0 on success, else Windows error code
+*/
+static DWORD level_step(MmcDevice *d, const LevelConfig *config, int channel,
+	float setting, BYTE *cmd, BYTE *rsp, float *dbm)
+{
+	DWORD err;
+	BYTE *op;
+	const BYTE *r = rsp + level_rsp_offset;
+
+	short q78 = (short)floorf(setting * 256.0f + 0.5f);
+	op = put_opcode(cmd, op_power, 4);
+	op[2] = (BYTE)channel;
+	op[3] = 0;                          // no override index
+	op[4] = (BYTE)(q78 & 0xff);
+	op[5] = (BYTE)((q78 >> 8) & 0xff);
+	if ((err = level_opcode(d, "POWER", cmd, rsp)) != 0)
+		return err;
+
+	// Only this setting's readings in the fifo. Measurement stays enabled
+	// after the run, see LevelRun()
+	op = put_opcode(cmd, op_meas_zmctl, 1);
+	op[2] = zmctl_clear | zmctl_enable;
+	if ((err = level_opcode(d, "MEAS_ZMCTL", cmd, rsp)) != 0)
+		return err;
+
+	if (config->settleUs > 0)
+		sched_wait_until(sched_ticks() + sched_us_to_ticks(config->settleUs), NULL);
+
+	// ZMON converts once per measured pulse, queued pulses run back to back
+	unsigned long long pulse = (unsigned long long)(channel & 0xff) |
+		((unsigned long long)config->pulseUs * pulse_ticks_per_us << pulse_width_shift) |
+		pulse_measure |
+		(((unsigned long long)config->measureAtUs * pulse_ticks_per_us + 1) << pulse_measure_at_shift);
+	long long pulsesDone = sched_ticks() + sched_us_to_ticks((long long)config->measCount * config->pulseUs);
+	for (int k = 0; k < config->measCount; k++)
+	{
+		op = put_opcode(cmd, op_pulse, 8);
+		for (int b = 0; b < 8; b++)
+			op[2 + b] = (BYTE)(pulse >> (8 * b));
+		if ((err = level_opcode(d, "PULSE", cmd, rsp)) != 0)
+			return err;
+	}
+
+	// Readings available, polled from the end of the last pulse
+	sched_wait_until(pulsesDone, NULL);
+	long long timeout = sched_ticks() + sched_us_to_ticks(level_meas_timeout_us);
+	int available;
+	for (;;)
+	{
+		put_opcode(cmd, op_meas_zmsize, 0);
+		if ((err = level_opcode(d, "MEAS_ZMSIZE", cmd, rsp)) != 0)
+			return err;
+		available = r[level_rsp_header] | (r[level_rsp_header + 1] << 8);
+		if (available >= config->measCount || sched_ticks() >= timeout)
+			break;
+	}
+	if (available == 0)
+	{
+		mmc_status(d, "Error, no MEAS readings after %d measured pulses.", config->measCount);
+		return ERROR_NO_DATA;
+	}
+	// Never ask for more than the fifo has, MEAS would pad with (0 + offset) * gain
+	if (available > config->measCount)
+		available = config->measCount;
+
+	op = put_opcode(cmd, op_meas, 4);
+	op[2] = meas_volts;
+	op[3] = 0;
+	op[4] = (BYTE)(available & 0xff);
+	op[5] = (BYTE)(available >> 8);
+	if ((err = level_opcode(d, "MEAS", cmd, rsp)) != 0)
+		return err;
+	int length = r[2] | (r[3] << 8);
+	if (length < available * level_volts_bytes)
+	{
+		mmc_status(d, "Error, MEAS returned %d bytes for %d readings.", length, available);
+		return ERROR_INVALID_FUNCTION;
+	}
+
+	// Average power, not volts, so the I/Q phase doesn't matter
+	float sumsq = 0.0f;
+	const BYTE *v = r + level_rsp_header;
+	for (int k = 0; k < available; k++, v += level_volts_bytes)
+	{
+		float vi = (float)get_int(v) / 65536.0f;
+		float vq = (float)get_int(v + 4) / 65536.0f;
+		sumsq += vi * vi + vq * vq;
+	}
+	*dbm = zmon_db(sumsq / (float)available);
+	return 0;
+}
+
+/*
+	Fill *config with the defaults: secant, 1/10 dB tolerance, 20 iterations,
+	1ms settle, 1 reading from a 100us pulse measured at 50us,
+	PI gains 0.3/0.7, POWER limited to 0..63 dBm.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int LevelDefaultConfig(LevelConfig *config)
+{
+	if (config == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	config->controller = level_secant;
+	config->maxIterations = 20;
+	config->settleUs = 1000;
+	config->measCount = 1;
+	config->pulseUs = 100;
+	config->measureAtUs = 50;
+	config->toleranceDb = 0.1f;
+	config->kp = 0.3f;
+	config->ki = 0.7f;
+	config->minSetting = 0.0f;
+	config->maxSetting = 63.0f;
+	return 0;
+}
+
+static int level_run(MmcDevice *d, const LevelConfig *config, int channel,
+	unsigned int frequency, float targetDbm, LevelResult *result)
+{
+	DWORD err;
+
+	if ((config->controller != level_secant && config->controller != level_pi) ||
+		config->maxIterations < 1 || config->measCount < 1 || config->measCount > level_max_meas ||
+		config->pulseUs < 1 || config->pulseUs > pulse_max_ticks / pulse_ticks_per_us ||
+		config->measureAtUs < 0 || config->measureAtUs >= config->pulseUs ||
+		config->toleranceDb <= 0.0f || config->minSetting > config->maxSetting)
+	{
+		err = 87;	// INVALID_PARAMETER
+		mmc_status(d, "Error %u, invalid leveler configuration.", err);
+		return err;
+	}
+
+	long long start = sched_ticks();
+	memset(result, 0, sizeof(LevelResult));
+
+	LevelKey key(channel, frequency);
+	float setting = targetDbm;
+	float slope = 1.0f;
+	AcquireSRWLockShared(&_warmLock);
+	std::map<LevelKey, LevelPoint>::const_iterator warm = _warm.find(key);
+	if (warm != _warm.end())
+	{
+		slope = warm->second.slope;
+		setting = warm->second.setting + (targetDbm - warm->second.measuredDbm) / slope;
+		result->warmStarted = 1;
+	}
+	ReleaseSRWLockShared(&_warmLock);
+
+	BYTE *cmd = (BYTE *)_aligned_malloc(2 * level_block_bytes, mmc_sector_bytes);
+	if (cmd == NULL)
+	{
+		err = ERROR_NOT_ENOUGH_MEMORY;
+		mmc_status(d, "Error %u allocating leveler buffers.", err);
+		return err;
+	}
+	BYTE *rsp = cmd + level_block_bytes;
+
+	// Settle & pulse waits sleep when they can, make that 1ms, not 15
+	timeBeginPeriod(1);
+
+	float lastSetting = 0.0f;
+	float lastDbm = 0.0f;
+	float lastError = 0.0f;
+	err = 0;
+	for (int n = 0; n < config->maxIterations; n++)
+	{
+		setting = clamp_setting(config, setting);
+		float dbm;
+		mmc_lock(d);
+		err = level_step(d, config, channel, setting, cmd, rsp, &dbm);
+		mmc_unlock(d);
+		if (err != 0)
+			break;
+
+		float error = targetDbm - dbm;
+		result->setting = setting;
+		result->measuredDbm = dbm;
+		result->errorDb = error;
+		result->iterations = n + 1;
+		if (fabsf(error) <= config->toleranceDb)
+		{
+			result->converged = 1;
+			break;
+		}
+
+		if (n > 0 && setting != lastSetting)
+		{
+			float measured = (dbm - lastDbm) / (setting - lastSetting);
+			if (measured >= level_min_slope && measured <= level_max_slope)
+				slope = measured;
+		}
+
+		float next;
+		if (config->controller == level_pi)
+			next = setting + config->kp * (error - (n == 0 ? 0.0f : lastError)) + config->ki * error;
+		else
+			next = setting + error / slope;
+
+		// Pinned at a limit & still asking for more, no point going on
+		if (clamp_setting(config, next) == setting)
+			break;
+
+		lastSetting = setting;
+		lastDbm = dbm;
+		lastError = error;
+		setting = next;
+	}
+	timeEndPeriod(1);
+	_aligned_free(cmd);
+	result->convergeUs = sched_ticks_to_us(sched_ticks() - start);
+
+	if (err != 0)
+		return err;
+	if (!result->converged)
+	{
+		err = ERROR_TIMEOUT;
+		mmc_status(d, "Error %u, channel %d not within %.2f dB of %.2f dBm after %d iterations, %.2f dBm at %.2f.",
+			err, channel, config->toleranceDb, targetDbm, result->iterations, result->measuredDbm, result->setting);
+		return err;
+	}
+
+	AcquireSRWLockExclusive(&_warmLock);
+	LevelPoint point = { result->setting, result->measuredDbm, slope };
+	_warm[key] = point;
+	ReleaseSRWLockExclusive(&_warmLock);
+
+	mmc_status(d, "Channel %d leveled to %.2f dBm in %d iterations, %.0f us.",
+		channel, result->measuredDbm, result->iterations, result->convergeUs);
+	return 0;
+}
+
+/*
+	Level channel to targetDbm of forward power at frequency. The caller has
+	already set the frequency, it's only used to look up & remember the
+	warm start point.
+
+	secant: the first step assumes 1 dB out per dB of POWER, or the slope
+	remembered with the warm start point, after that each step uses the
+	slope between the last two points.
+	pi: setting += kp * (error - last error) + ki * error
+
+	*result is filled in whether or not the loop converges. Other users of
+	the device wait while an iteration runs, settleUs plus
+	measCount * pulseUs and the transfers.
+
+	Side effect: every iteration sends MEAS_ZMCTL with the enable bit set,
+	so ZMON measurement is left enabled for the whole FPGA, not just this
+	channel, and anything already in the MEAS fifo is discarded. ZMCTL has
+	no read back, the enable state from before the call can't be restored.
+	Enabled is the FPGA's reset state; a caller that had disabled
+	measurement must send MEAS_ZMCTL again after LevelRun().
+
+	Returns: 0 when converged, ERROR_TIMEOUT if not within toleranceDb after
+	maxIterations or with POWER at a limit, else Windows error code
+*/
+DllExport int LevelRun(MmcHandle hMmc, const LevelConfig *config, int channel,
+	unsigned int frequency, float targetDbm, LevelResult *result)
+{
+	if (config == NULL || result == NULL)
+		return 87;	// INVALID_PARAMETER
+	MmcDevice *d = mmc_acquire(hMmc);
+	if (d == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	int err = level_run(d, config, channel, frequency, targetDbm, result);
+	mmc_release(d);
+	return err;
+}
+
+/*
+	Forget all remembered warm start points, e.g. after the hardware changes
+
+	Returns: 0
+*/
+DllExport int LevelClearWarmStart()
+{
+	AcquireSRWLockExclusive(&_warmLock);
+	_warm.clear();
+	ReleaseSRWLockExclusive(&_warmLock);
+	return 0;
+}
@@ -0,0 +1,58 @@
+//
+// leveler.h : Native closed-loop power leveling.
+//
+// Sets a channel's output to a target dBm, as measured by its ZMON
+// forward coupler, by iterating POWER, measured PULSEs & MEAS back to back
+// on the MMC device instead of a managed send/sleep/measure loop. ZMON only
+// converts during a PULSE with its measure flag set, so each iteration
+// clears the MEAS fifo, pulses once per reading and reads back what
+// MEAS_ZMSIZE says arrived. The device lock is held for the whole
+// iteration so no other opcode lands between POWER and MEAS. Every converged
+// point is remembered per channel & frequency; the next request at that
+// channel & frequency starts from the remembered POWER offset, so most
+// re-levels converge in one or two iterations.
+//
+// LevelRun() leaves ZMON measurement enabled, an FPGA wide setting, and
+// empties the MEAS fifo. The FPGA can't report the enable state, so a
+// caller that had disabled measurement has to disable it again.
+//
+#pragma once
+
+#include "mmc_io_v2.h"
+
+// Controllers for LevelConfig.controller
+#define level_secant 0
+#define level_pi 1
+
+#define level_max_meas 16                   // readings averaged per iteration
+
+typedef struct LevelConfig
+{
+	int controller;                     // level_secant or level_pi
+	int maxIterations;
+	int settleUs;                       // wait between POWER & the first PULSE
+	int measCount;                      // readings averaged, 1..level_max_meas
+	int pulseUs;                        // width of each measured PULSE
+	int measureAtUs;                    // ZMON conversion this far into the pulse
+	float toleranceDb;                  // converged when |target - measured| <= this
+	float kp;                           // level_pi gains, dB of POWER per dB of error
+	float ki;
+	float minSetting;                   // POWER opcode dBm limits
+	float maxSetting;
+} LevelConfig;
+
+typedef struct LevelResult
+{
+	float setting;                      // last POWER opcode dBm sent
+	float measuredDbm;                  // forward dBm measured at that setting
+	float errorDb;                      // target - measured
+	int iterations;                     // POWER/PULSE/MEAS cycles run
+	int converged;                      // 1 if within toleranceDb
+	int warmStarted;                    // 1 if started from a remembered point
+	double convergeUs;                  // from the call to the last MEAS
+} LevelResult;
+
+DllExport int LevelDefaultConfig(LevelConfig *config);
+DllExport int LevelRun(MmcHandle hMmc, const LevelConfig *config, int channel,
+	unsigned int frequency, float targetDbm, LevelResult *result);
+DllExport int LevelClearWarmStart();
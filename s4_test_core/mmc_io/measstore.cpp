@@ -0,0 +1,793 @@
+//
+// measstore.cpp : Append-only, memory-mapped measurement store, see measstore.h
+//
+#include "stdafx.h"
+#include "measstore.h"
+
+#include <stdlib.h>
+
+#define store_writer_magic 0x57534d53       // handle validation
+#define store_reader_magic 0x52534d53
+#define max_varint_bytes 10
+
+typedef struct MeasStore
+{
+	unsigned int magic;
+	CRITICAL_SECTION lock;
+	HANDLE hFile;
+	HANDLE hMap;
+	MeasFileHeader *header;             // view of the file header
+	BYTE *view;                         // view of the segment being appended to
+	long long viewOffset;
+	long long viewBytes;
+	long long fileBytes;
+	DWORD flushMs;
+	ULONGLONG stagedSince;              // tick count when first staged row arrived
+	int staged;
+	MeasRecord rows[measstore_chunk_rows];
+} MeasStore;
+
+typedef struct MeasReader
+{
+	unsigned int magic;
+	HANDLE hFile;
+	HANDLE hMap;
+	MeasFileHeader header;              // snapshot taken at open
+	BYTE *view;
+	long long viewOffset;
+	long long viewBytes;
+	long long fileBytes;
+	long long decodedOffset;            // chunk currently in rows[], -1 if none
+	MeasRecord rows[measstore_chunk_rows];
+} MeasReader;
+
+static DWORD allocation_granularity()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+}
+
+static long long get_column(const MeasRecord *r, int column)
+{
+	switch (column)
+	{
+	case mcol_timestamp:	return r->timestamp;
+	case mcol_fwdI:			return r->fwdI;
+	case mcol_fwdQ:			return r->fwdQ;
+	case mcol_rflI:			return r->rflI;
+	case mcol_rflQ:			return r->rflQ;
+	case mcol_fwdIVolts:	return r->fwdIVolts;
+	case mcol_fwdQVolts:	return r->fwdQVolts;
+	case mcol_rflIVolts:	return r->rflIVolts;
+	case mcol_rflQVolts:	return r->rflQVolts;
+	case mcol_fwdDbm:		return r->fwdDbm;
+	case mcol_rflDbm:		return r->rflDbm;
+	case mcol_temperature:	return r->temperature;
+	case mcol_alarms:		return r->alarms;
+	}
+	return 0;
+}
+
+static void set_column(MeasRecord *r, int column, long long value)
+{
+	switch (column)
+	{
+	case mcol_timestamp:	r->timestamp = value; break;
+	case mcol_fwdI:			r->fwdI = (short)value; break;
+	case mcol_fwdQ:			r->fwdQ = (short)value; break;
+	case mcol_rflI:			r->rflI = (short)value; break;
+	case mcol_rflQ:			r->rflQ = (short)value; break;
+	case mcol_fwdIVolts:	r->fwdIVolts = (int)value; break;
+	case mcol_fwdQVolts:	r->fwdQVolts = (int)value; break;
+	case mcol_rflIVolts:	r->rflIVolts = (int)value; break;
+	case mcol_rflQVolts:	r->rflQVolts = (int)value; break;
+	case mcol_fwdDbm:		r->fwdDbm = (short)value; break;
+	case mcol_rflDbm:		r->rflDbm = (short)value; break;
+	case mcol_temperature:	r->temperature = (short)value; break;
+	case mcol_alarms:		r->alarms = (unsigned int)value; break;
+	}
+}
+
+// Zigzag maps small negative deltas to small unsigned values
+static BYTE *put_varint(BYTE *p, long long value)
+{
+	unsigned long long v = ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+	while (v >= 0x80)
+	{
+		*p++ = (BYTE)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (BYTE)v;
+	return p;
+}
+
+static const BYTE *get_varint(const BYTE *p, const BYTE *end, long long *value)
+{
+	unsigned long long v = 0;
+	int shift = 0;
+	while (p < end && shift < 64)
+	{
+		BYTE b = *p++;
+		v |= (unsigned long long)(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+		{
+			*value = (long long)(v >> 1) ^ -(long long)(v & 1);
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+/*
+	Map a file window covering [offset, offset + bytes).
+	The mapping object is sized to fileBytes.
+
+	Returns: 0 on success, else Windows error code
+*/
+static DWORD map_window(HANDLE hFile, HANDLE *hMap, bool writable, long long fileBytes,
+	long long offset, long long bytes, BYTE **view, long long *viewOffset, long long *viewBytes)
+{
+	long long granularity = allocation_granularity();
+	long long start = offset - offset % granularity;
+	long long length = offset + bytes - start;
+
+	if (*view != NULL)
+	{
+		UnmapViewOfFile(*view);
+		*view = NULL;
+	}
+	if (*hMap == NULL)
+	{
+		LARGE_INTEGER size;
+		size.QuadPart = fileBytes;
+		*hMap = CreateFileMapping(hFile, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+			size.HighPart, size.LowPart, NULL);
+		if (*hMap == NULL)
+			return GetLastError();
+	}
+
+	LARGE_INTEGER at;
+	at.QuadPart = start;
+	*view = (BYTE *)MapViewOfFile(*hMap, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+		at.HighPart, at.LowPart, (SIZE_T)length);
+	if (*view == NULL)
+		return GetLastError();
+	*viewOffset = start;
+	*viewBytes = length;
+	return 0;
+}
+
+static void store_unmap(MeasStore *s)
+{
+	if (s->header != NULL)
+		UnmapViewOfFile(s->header);
+	if (s->view != NULL)
+		UnmapViewOfFile(s->view);
+	if (s->hMap != NULL)
+		CloseHandle(s->hMap);
+	s->header = NULL;
+	s->view = NULL;
+	s->hMap = NULL;
+}
+
+/*
+	Make sure the data view has room for bytes more at dataEnd, growing the
+	file a segment at a time and re-mapping when needed.
+	The new mapping is built before the old one is released, so on failure
+	the store is still mapped as it was & can be sealed or closed.
+
+	Returns: 0 on success, else Windows error code
+*/
+static DWORD store_reserve(MeasStore *s, long long dataEnd, long long bytes)
+{
+	if (s->view != NULL && dataEnd + bytes <= s->viewOffset + s->viewBytes)
+		return 0;
+
+	long long granularity = allocation_granularity();
+	long long start = dataEnd - dataEnd % granularity;
+	long long end = start + measstore_segment_bytes;
+	if (end < dataEnd + bytes)
+		end = dataEnd + bytes;
+
+	// Growing is allowed while the old views are mapped, only shrinking isn't
+	if (end > s->fileBytes)
+	{
+		LARGE_INTEGER size;
+		size.QuadPart = end;
+		if (!SetFilePointerEx(s->hFile, size, NULL, FILE_BEGIN) || !SetEndOfFile(s->hFile))
+			return GetLastError();
+		s->fileBytes = end;
+	}
+
+	HANDLE hMap = NULL;
+	BYTE *header = NULL;
+	BYTE *view = NULL;
+	long long headerOffset, headerBytes, viewOffset, viewBytes;
+	DWORD err = map_window(s->hFile, &hMap, true, s->fileBytes, 0, measstore_header_bytes,
+		&header, &headerOffset, &headerBytes);
+	if (err == 0)
+		err = map_window(s->hFile, &hMap, true, s->fileBytes, start, end - start,
+			&view, &viewOffset, &viewBytes);
+	if (err != 0)
+	{
+		if (header != NULL)
+			UnmapViewOfFile(header);
+		if (hMap != NULL)
+			CloseHandle(hMap);
+		return err;
+	}
+
+	store_unmap(s);
+	s->hMap = hMap;
+	s->header = (MeasFileHeader *)header;
+	s->view = view;
+	s->viewOffset = viewOffset;
+	s->viewBytes = viewBytes;
+	return 0;
+}
+
+/*
+	Encode the staged rows as a new chunk after the last sealed one and
+	commit it by advancing dataEnd in the file header. The chunk is on disk
+	before dataEnd moves, so after a crash dataEnd never points past a torn
+	chunk. On failure the rows stay staged.
+
+	Returns: 0 on success, else Windows error code
+*/
+static DWORD store_seal(MeasStore *s)
+{
+	if (s->staged == 0)
+		return 0;
+	if (s->header == NULL)
+		return ERROR_INVALID_HANDLE;
+
+	long long dataEnd = s->header->dataEnd;
+	long long bound = sizeof(MeasChunkHeader) + (long long)s->staged * mcol_count * max_varint_bytes + 8;
+	DWORD err = store_reserve(s, dataEnd, bound);
+	if (err != 0)
+		return err;
+
+	BYTE *base = s->view + (dataEnd - s->viewOffset);
+	BYTE *p = base + sizeof(MeasChunkHeader);
+	MeasChunkHeader chunk;
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.magic = measstore_chunk_magic;
+	chunk.rows = s->staged;
+
+	for (int c = 0; c < mcol_count; c++)
+	{
+		BYTE *column = p;
+		long long previous = 0;
+		chunk.minValue[c] = chunk.maxValue[c] = get_column(&s->rows[0], c);
+		for (int r = 0; r < s->staged; r++)
+		{
+			long long value = get_column(&s->rows[r], c);
+			p = put_varint(p, value - previous);
+			previous = value;
+			if (value < chunk.minValue[c])
+				chunk.minValue[c] = value;
+			if (value > chunk.maxValue[c])
+				chunk.maxValue[c] = value;
+			if (c != mcol_timestamp)
+				chunk.sum[c] += value;
+		}
+		chunk.columnBytes[c] = (unsigned int)(p - column);
+	}
+	while ((p - base) % 8 != 0)
+		*p++ = 0;
+	chunk.bytes = (unsigned int)(p - base);
+	memcpy(base, &chunk, sizeof(chunk));
+	if (!FlushViewOfFile(base, chunk.bytes) || !FlushFileBuffers(s->hFile))
+		return GetLastError();
+
+	MeasFileHeader *h = s->header;
+	if (h->rows == 0)
+		h->firstTimestamp = s->rows[0].timestamp;
+	h->lastTimestamp = s->rows[s->staged - 1].timestamp;
+	h->rows += s->staged;
+	h->chunks++;
+	h->dataEnd = dataEnd + chunk.bytes;
+	s->staged = 0;
+	return 0;
+}
+
+static MeasStore *store_from_handle(HANDLE hStore)
+{
+	MeasStore *s = (MeasStore *)hStore;
+	if (s == NULL || s->magic != store_writer_magic)
+		return NULL;
+	return s;
+}
+
+static MeasReader *reader_from_handle(HANDLE hReader)
+{
+	MeasReader *r = (MeasReader *)hReader;
+	if (r == NULL || r->magic != store_reader_magic)
+		return NULL;
+	return r;
+}
+
+/*
+	Open a store for appending, creating it if it doesn't exist.
+	Staged rows are sealed into a chunk every measstore_chunk_rows rows, or
+	on the first append flushMs after the oldest staged row, whichever is
+	first. flushMs of 0 seals only on full chunks & MstoreFlush().
+	On success, *hStore is the store handle.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreOpen(const char *path, int flushMs, HANDLE *hStore)
+{
+	DWORD err;
+	if (path == NULL || hStore == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	MeasStore *s = (MeasStore *)calloc(1, sizeof(MeasStore));
+	if (s == NULL)
+	{
+		err = ERROR_NOT_ENOUGH_MEMORY;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u allocating measurement store.", err);
+		return err;
+	}
+
+	s->hFile = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (s->hFile == INVALID_HANDLE_VALUE)
+	{
+		err = GetLastError();
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u opening measurement store %s.", err, path);
+		free(s);
+		return err;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(s->hFile, &size);
+	s->fileBytes = size.QuadPart;
+	bool existing = s->fileBytes > 0;
+
+	long long dataEnd = measstore_header_bytes;
+	if (existing)
+	{
+		MeasFileHeader h;
+		DWORD byte_count;
+		if (!ReadFile(s->hFile, &h, sizeof(h), &byte_count, NULL) || byte_count != sizeof(h) ||
+			h.magic != measstore_magic || h.version != measstore_version ||
+			h.columns != mcol_count || h.dataEnd < measstore_header_bytes || h.dataEnd > s->fileBytes)
+		{
+			err = ERROR_BAD_FORMAT;
+			_snprintf_s(_lastError, max_bytes_returned, "Error %u, %s is not a measurement store.", err, path);
+			CloseHandle(s->hFile);
+			free(s);
+			return err;
+		}
+		dataEnd = h.dataEnd;
+	}
+
+	err = store_reserve(s, dataEnd, 0);
+	if (err != 0)
+	{
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u mapping measurement store.", err);
+		store_unmap(s);
+		CloseHandle(s->hFile);
+		free(s);
+		return err;
+	}
+
+	if (!existing)
+	{
+		memset(s->header, 0, sizeof(MeasFileHeader));
+		s->header->magic = measstore_magic;
+		s->header->version = measstore_version;
+		s->header->columns = mcol_count;
+		s->header->chunkRows = measstore_chunk_rows;
+		s->header->dataEnd = measstore_header_bytes;
+	}
+
+	InitializeCriticalSection(&s->lock);
+	s->flushMs = flushMs > 0 ? flushMs : 0;
+	s->magic = store_writer_magic;
+	*hStore = (HANDLE)s;
+
+	_snprintf_s(_lastError, max_bytes_returned, "Measurement store has %I64i rows.", s->header->rows);
+	return 0;
+}
+
+/*
+	Stage records for the store, sealing chunks as they fill.
+	A full chunk is sealed when the next record needs the room. If it can't
+	be sealed (e.g. disk full) it stays staged & the next call retries it;
+	records from that one on are not taken, the status text says how many were.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreAppend(HANDLE hStore, const MeasRecord *records, int count)
+{
+	DWORD err = 0;
+	MeasStore *s = store_from_handle(hStore);
+	if (s == NULL || (records == NULL && count > 0) || count < 0)
+		return 87;	// INVALID_PARAMETER
+
+	EnterCriticalSection(&s->lock);
+	int taken = 0;
+	for (; taken < count; taken++)
+	{
+		if (s->staged == measstore_chunk_rows)
+		{
+			err = store_seal(s);
+			if (err != 0)
+				break;
+		}
+		if (s->staged == 0)
+			s->stagedSince = GetTickCount64();
+		s->rows[s->staged++] = records[taken];
+	}
+	if (err == 0 && s->staged > 0 && s->flushMs > 0 &&
+		GetTickCount64() - s->stagedSince >= s->flushMs)
+		err = store_seal(s);
+	LeaveCriticalSection(&s->lock);
+
+	if (err != 0)
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u writing measurement store, %d of %d records taken.", err, taken, count);
+	return err;
+}
+
+/*
+	Seal any staged rows and flush the mapped views to disk.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreFlush(HANDLE hStore)
+{
+	MeasStore *s = store_from_handle(hStore);
+	if (s == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	EnterCriticalSection(&s->lock);
+	DWORD err = store_seal(s);
+	if (err == 0 && (s->header == NULL || !FlushViewOfFile(s->header, 0) || !FlushFileBuffers(s->hFile)))
+		err = s->header == NULL ? ERROR_INVALID_HANDLE : GetLastError();
+	LeaveCriticalSection(&s->lock);
+
+	if (err != 0)
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u flushing measurement store.", err);
+	return err;
+}
+
+/*
+	Seal staged rows, trim the pre-allocated segment & close the store.
+	While a reader still has the store open the file can't be shrunk, the
+	unused tail is then left in place; dataEnd marks the end of the data &
+	the next MstoreOpen() appends over the tail.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreClose(HANDLE hStore)
+{
+	MeasStore *s = store_from_handle(hStore);
+	if (s == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	DWORD err = store_seal(s);
+	long long dataEnd = 0;
+	long long rows = 0;
+	if (s->header != NULL)
+	{
+		if (err == 0 && !FlushViewOfFile(s->header, 0))
+			err = GetLastError();
+		dataEnd = s->header->dataEnd;
+		rows = s->header->rows;
+	}
+	store_unmap(s);
+
+	bool trimmed = false;
+	if (err == 0 && dataEnd > 0)
+	{
+		LARGE_INTEGER size;
+		size.QuadPart = dataEnd;
+		if (SetFilePointerEx(s->hFile, size, NULL, FILE_BEGIN) && SetEndOfFile(s->hFile))
+			trimmed = true;
+		else if ((err = GetLastError()) == ERROR_USER_MAPPED_FILE)
+			err = 0;
+	}
+	CloseHandle(s->hFile);
+	DeleteCriticalSection(&s->lock);
+	s->magic = 0;
+	free(s);
+
+	if (err != 0)
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u closing measurement store.", err);
+	else if (!trimmed)
+		_snprintf_s(_lastError, max_bytes_returned, "Measurement store closed, %I64i rows, tail kept, still open for reading.", rows);
+	else
+		_snprintf_s(_lastError, max_bytes_returned, "Measurement store closed, %I64i rows.", rows);
+	return err;
+}
+
+/*
+	Open a store for reading. Works on a store that is still being written,
+	the reader sees the chunks sealed when it was opened. A writer closing
+	while this is open can't trim its pre-allocated tail, see MstoreClose().
+	On success, *hReader is the reader handle.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreOpenRead(const char *path, HANDLE *hReader)
+{
+	DWORD err;
+	if (path == NULL || hReader == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	MeasReader *r = (MeasReader *)calloc(1, sizeof(MeasReader));
+	if (r == NULL)
+	{
+		err = ERROR_NOT_ENOUGH_MEMORY;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u allocating measurement reader.", err);
+		return err;
+	}
+
+	r->hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (r->hFile == INVALID_HANDLE_VALUE)
+	{
+		err = GetLastError();
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u opening measurement store %s.", err, path);
+		free(r);
+		return err;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(r->hFile, &size);
+	r->fileBytes = size.QuadPart;
+	err = r->fileBytes < measstore_header_bytes ? ERROR_BAD_FORMAT :
+		map_window(r->hFile, &r->hMap, false, 0, 0, sizeof(MeasFileHeader),
+			&r->view, &r->viewOffset, &r->viewBytes);
+	if (err == 0)
+	{
+		memcpy(&r->header, r->view, sizeof(MeasFileHeader));
+		if (r->header.magic != measstore_magic || r->header.version != measstore_version ||
+			r->header.columns != mcol_count || r->header.dataEnd > r->fileBytes)
+			err = ERROR_BAD_FORMAT;
+	}
+	if (err != 0)
+	{
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, %s is not a measurement store.", err, path);
+		if (r->view != NULL)
+			UnmapViewOfFile(r->view);
+		if (r->hMap != NULL)
+			CloseHandle(r->hMap);
+		CloseHandle(r->hFile);
+		free(r);
+		return err;
+	}
+
+	r->decodedOffset = -1;
+	r->magic = store_reader_magic;
+	*hReader = (HANDLE)r;
+	_snprintf_s(_lastError, max_bytes_returned, "Measurement store has %I64i rows.", r->header.rows);
+	return 0;
+}
+
+/*
+	Map the chunk at offset, validate its header.
+
+	Returns: 0 on success, else Windows error code
+*/
+static DWORD reader_chunk(MeasReader *r, long long offset, MeasChunkHeader *chunk, const BYTE **data)
+{
+	if (offset + (long long)sizeof(MeasChunkHeader) > r->header.dataEnd)
+		return ERROR_FILE_CORRUPT;
+
+	if (r->view == NULL || offset < r->viewOffset ||
+		offset + (long long)sizeof(MeasChunkHeader) > r->viewOffset + r->viewBytes)
+	{
+		long long bytes = measstore_segment_bytes;
+		if (offset + bytes > r->header.dataEnd)
+			bytes = r->header.dataEnd - offset;
+		DWORD err = map_window(r->hFile, &r->hMap, false, 0, offset, bytes,
+			&r->view, &r->viewOffset, &r->viewBytes);
+		if (err != 0)
+			return err;
+	}
+
+	memcpy(chunk, r->view + (offset - r->viewOffset), sizeof(MeasChunkHeader));
+	if (chunk->magic != measstore_chunk_magic || chunk->rows == 0 ||
+		chunk->rows > measstore_chunk_rows || chunk->bytes < sizeof(MeasChunkHeader) ||
+		offset + chunk->bytes > r->header.dataEnd)
+		return ERROR_FILE_CORRUPT;
+
+	// Chunk straddles the end of the window, re-map starting at the chunk
+	if (offset + chunk->bytes > r->viewOffset + r->viewBytes)
+	{
+		DWORD err = map_window(r->hFile, &r->hMap, false, 0, offset, chunk->bytes,
+			&r->view, &r->viewOffset, &r->viewBytes);
+		if (err != 0)
+			return err;
+	}
+	*data = r->view + (offset - r->viewOffset);
+	return 0;
+}
+
+static DWORD reader_decode(MeasReader *r, long long offset, const MeasChunkHeader *chunk, const BYTE *data)
+{
+	if (r->decodedOffset == offset)
+		return 0;
+
+	const BYTE *p = data + sizeof(MeasChunkHeader);
+	const BYTE *end = data + chunk->bytes;
+	for (int c = 0; c < mcol_count; c++)
+	{
+		const BYTE *column_end = p + chunk->columnBytes[c];
+		if (column_end > end)
+			return ERROR_FILE_CORRUPT;
+		long long value = 0;
+		for (unsigned int k = 0; k < chunk->rows; k++)
+		{
+			long long delta;
+			p = get_varint(p, column_end, &delta);
+			if (p == NULL)
+				return ERROR_FILE_CORRUPT;
+			value += delta;
+			set_column(&r->rows[k], c, value);
+		}
+		p = column_end;
+	}
+	r->decodedOffset = offset;
+	return 0;
+}
+
+/*
+	Store totals as of MstoreOpenRead()
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreInfo(HANDLE hReader, MeasStoreInfo *info)
+{
+	MeasReader *r = reader_from_handle(hReader);
+	if (r == NULL || info == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	info->rows = r->header.rows;
+	info->chunks = r->header.chunks;
+	info->firstTimestamp = r->header.firstTimestamp;
+	info->lastTimestamp = r->header.lastTimestamp;
+	info->fileBytes = r->fileBytes;
+	return 0;
+}
+
+/*
+	Copy up to maxRecords rows with tStart <= timestamp <= tEnd into records.
+	Chunks outside the range are skipped using their headers only.
+	Call repeatedly with the same cursor until *count is 0.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreRead(HANDLE hReader, long long tStart, long long tEnd,
+	MeasRecord *records, int maxRecords, int *count, MeasCursor *cursor)
+{
+	MeasReader *r = reader_from_handle(hReader);
+	if (r == NULL || records == NULL || count == NULL || cursor == NULL || maxRecords <= 0)
+		return 87;	// INVALID_PARAMETER
+
+	long long offset = cursor->chunkOffset < measstore_header_bytes ? measstore_header_bytes : cursor->chunkOffset;
+	int row = cursor->row;
+	DWORD err = 0;
+	*count = 0;
+
+	while (offset < r->header.dataEnd && *count < maxRecords)
+	{
+		MeasChunkHeader chunk;
+		const BYTE *data;
+		if ((err = reader_chunk(r, offset, &chunk, &data)) != 0)
+			break;
+
+		if (chunk.maxValue[mcol_timestamp] >= tStart && chunk.minValue[mcol_timestamp] <= tEnd)
+		{
+			if ((err = reader_decode(r, offset, &chunk, data)) != 0)
+				break;
+			for (; row < (int)chunk.rows && *count < maxRecords; row++)
+			{
+				long long t = r->rows[row].timestamp;
+				if (t >= tStart && t <= tEnd)
+					records[(*count)++] = r->rows[row];
+			}
+			if (row < (int)chunk.rows)
+				break;
+		}
+		offset += chunk.bytes;
+		row = 0;
+	}
+
+	cursor->chunkOffset = offset;
+	cursor->row = row;
+	if (err != 0)
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u reading measurement store at %I64i.", err, offset);
+	return err;
+}
+
+/*
+	Count, min, max & mean of one column over tStart <= timestamp <= tEnd.
+	Chunks entirely inside the range are summarised from their headers
+	without being decoded.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreAggregate(HANDLE hReader, long long tStart, long long tEnd,
+	int column, MeasAggregate *aggregate)
+{
+	MeasReader *r = reader_from_handle(hReader);
+	if (r == NULL || aggregate == NULL || column < 0 || column >= mcol_count)
+		return 87;	// INVALID_PARAMETER
+
+	double sum = 0.0;
+	long long offset = measstore_header_bytes;
+	DWORD err = 0;
+	memset(aggregate, 0, sizeof(MeasAggregate));
+
+	while (offset < r->header.dataEnd)
+	{
+		MeasChunkHeader chunk;
+		const BYTE *data;
+		if ((err = reader_chunk(r, offset, &chunk, &data)) != 0)
+			break;
+
+		long long tMin = chunk.minValue[mcol_timestamp];
+		long long tMax = chunk.maxValue[mcol_timestamp];
+		if (tMin >= tStart && tMax <= tEnd && column != mcol_timestamp)
+		{
+			if (aggregate->count == 0 || chunk.minValue[column] < aggregate->minValue)
+				aggregate->minValue = chunk.minValue[column];
+			if (aggregate->count == 0 || chunk.maxValue[column] > aggregate->maxValue)
+				aggregate->maxValue = chunk.maxValue[column];
+			sum += (double)chunk.sum[column];
+			aggregate->count += chunk.rows;
+		}
+		else if (tMax >= tStart && tMin <= tEnd)
+		{
+			if ((err = reader_decode(r, offset, &chunk, data)) != 0)
+				break;
+			for (unsigned int k = 0; k < chunk.rows; k++)
+			{
+				long long t = r->rows[k].timestamp;
+				if (t < tStart || t > tEnd)
+					continue;
+				long long value = get_column(&r->rows[k], column);
+				if (aggregate->count == 0 || value < aggregate->minValue)
+					aggregate->minValue = value;
+				if (aggregate->count == 0 || value > aggregate->maxValue)
+					aggregate->maxValue = value;
+				sum += (double)value;
+				aggregate->count++;
+			}
+		}
+		offset += chunk.bytes;
+	}
+
+	if (aggregate->count > 0)
+		aggregate->mean = sum / aggregate->count;
+	if (err != 0)
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u reading measurement store at %I64i.", err, offset);
+	return err;
+}
+
+/*
+	Close a reader
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MstoreCloseRead(HANDLE hReader)
+{
+	MeasReader *r = reader_from_handle(hReader);
+	if (r == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	if (r->view != NULL)
+		UnmapViewOfFile(r->view);
+	if (r->hMap != NULL)
+		CloseHandle(r->hMap);
+	CloseHandle(r->hFile);
+	r->magic = 0;
+	free(r);
+	return 0;
+}
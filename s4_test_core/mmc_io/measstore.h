@@ -0,0 +1,128 @@
+//
+// measstore.h : Append-only, memory-mapped measurement store for soak runs.
+//
+// Decoded measurements are staged in memory and sealed into compressed,
+// columnar chunks in a file that is mapped a segment at a time. Each
+// column of a chunk is delta + zigzag varint encoded, timestamps and
+// slowly moving readings shrink to a byte or two per row. Every chunk
+// header carries per-column min/max/sum so readers can skip or aggregate
+// whole chunks without decoding them.
+//
+// File layout:
+//	MeasFileHeader, padded to measstore_header_bytes
+//	MeasChunkHeader, column 0 bytes, column 1 bytes, ... (8 byte aligned)
+//	MeasChunkHeader, ...
+//
+#pragma once
+
+#include "mmc_io.h"
+
+#define measstore_magic 0x5254534d          // "MSTR"
+#define measstore_chunk_magic 0x4b48434d    // "MCHK"
+#define measstore_version 1
+#define measstore_header_bytes 4096
+#define measstore_chunk_rows 4096           // rows staged before a chunk is sealed
+#define measstore_segment_bytes (16 * 1024 * 1024)
+
+// One decoded measurement, a row in the store
+typedef struct MeasRecord
+{
+	long long timestamp;                // microseconds, caller's time base
+	short fwdI;                         // raw ADC counts
+	short fwdQ;
+	short rflI;
+	short rflQ;
+	int fwdIVolts;                      // Q15.16 calibrated volts, as MEAS returns them
+	int fwdQVolts;
+	int rflIVolts;
+	int rflQVolts;
+	short fwdDbm;                       // Q7.8 dBm
+	short rflDbm;
+	short temperature;                  // Q7.8 degrees C
+	short reserved;
+	unsigned int alarms;                // ALARMS opcode bits
+} MeasRecord;
+
+// Column numbers for MstoreAggregate()
+enum MeasColumn
+{
+	mcol_timestamp,
+	mcol_fwdI,
+	mcol_fwdQ,
+	mcol_rflI,
+	mcol_rflQ,
+	mcol_fwdIVolts,
+	mcol_fwdQVolts,
+	mcol_rflIVolts,
+	mcol_rflQVolts,
+	mcol_fwdDbm,
+	mcol_rflDbm,
+	mcol_temperature,
+	mcol_alarms,
+	mcol_count
+};
+
+typedef struct MeasFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int columns;
+	unsigned int chunkRows;
+	long long rows;                     // rows in sealed chunks
+	long long chunks;
+	long long dataEnd;                  // file offset past the last sealed chunk
+	long long firstTimestamp;
+	long long lastTimestamp;
+} MeasFileHeader;
+
+typedef struct MeasChunkHeader
+{
+	unsigned int magic;
+	unsigned int rows;
+	unsigned int bytes;                 // header plus encoded columns, 8 byte aligned
+	unsigned int reserved;
+	long long minValue[mcol_count];
+	long long maxValue[mcol_count];
+	long long sum[mcol_count];
+	unsigned int columnBytes[mcol_count];
+} MeasChunkHeader;
+
+// Resume point for MstoreRead(), zero it to start at the beginning
+typedef struct MeasCursor
+{
+	long long chunkOffset;
+	int row;
+	int reserved;
+} MeasCursor;
+
+typedef struct MeasAggregate
+{
+	long long count;
+	long long minValue;
+	long long maxValue;
+	double mean;
+} MeasAggregate;
+
+typedef struct MeasStoreInfo
+{
+	long long rows;
+	long long chunks;
+	long long firstTimestamp;
+	long long lastTimestamp;
+	long long fileBytes;
+} MeasStoreInfo;
+
+// Writer
+DllExport int MstoreOpen(const char *path, int flushMs, HANDLE *hStore);
+DllExport int MstoreAppend(HANDLE hStore, const MeasRecord *records, int count);
+DllExport int MstoreFlush(HANDLE hStore);
+DllExport int MstoreClose(HANDLE hStore);
+
+// Reader
+DllExport int MstoreOpenRead(const char *path, HANDLE *hReader);
+DllExport int MstoreInfo(HANDLE hReader, MeasStoreInfo *info);
+DllExport int MstoreRead(HANDLE hReader, long long tStart, long long tEnd,
+	MeasRecord *records, int maxRecords, int *count, MeasCursor *cursor);
+DllExport int MstoreAggregate(HANDLE hReader, long long tStart, long long tEnd,
+	int column, MeasAggregate *aggregate);
+DllExport int MstoreCloseRead(HANDLE hReader);
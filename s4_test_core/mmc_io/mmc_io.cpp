@@ -2,14 +2,13 @@
 // mmc_io.cpp : Defines the exported functions for the DLL application.
 //
 #include "stdafx.h"
+#include "mmc_io.h"
 
-#define DllExport extern "C" __declspec(dllexport) 
 #define dump_buffersize_megs 16
 #define dump_buffersize (dump_buffersize_megs * 1024 * 1024)
 #define dump_workingsetsize ((dump_buffersize_megs + 1) * 1024 * 1024)
-#define max_bytes_returned 512
 
-static char _lastError[max_bytes_returned];
+char _lastError[max_bytes_returned];
 static HANDLE hdevice;
 //DWORD bytes_to_transfer, byte_count;
 static OVERLAPPED overlapped;
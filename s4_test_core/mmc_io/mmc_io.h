@@ -0,0 +1,21 @@
+//
+// mmc_io.h : Definitions shared by the mmc_io translation units.
+//
+#pragma once
+
+#ifdef MMC_IO_EXPORTS
+#define DllExport extern "C" __declspec(dllexport)
+#else
+#define DllExport extern "C" __declspec(dllimport)
+#endif
+#define max_bytes_returned 512
+
+// Last status/error text, returned to callers by GetMmcStatus()
+extern char _lastError[max_bytes_returned];
+
+// Version 1 exports, one device per process
+DllExport char *GetMmcStatus();
+DllExport int OpenMmc(const char *deviceName, HANDLE *hDevice);
+DllExport int CloseMmc(HANDLE hDevice);
+DllExport int WriteMmc(HANDLE hMmc, unsigned char *data, int bytes);
+DllExport int ReadMmc(int hDevice, unsigned char **data, int bytes);
@@ -0,0 +1,485 @@
+//
+// mmc_io_v2.cpp : Version 2 MMC device ABI, see mmc_io_v2.h
+//
+#include "stdafx.h"
+#include "mmc_io_v2.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#define mmc_max_devices 16
+
+struct MmcDevice
+{
+	volatile LONG refs;                 // the table's, plus each mmc_acquire()
+	volatile LONG attached;             // mmc_attach() users, MmcClose() is refused
+	CRITICAL_SECTION lock;              // one transfer at a time per device
+	HANDLE hDevice;
+	OVERLAPPED overlapped;
+	long long deviceBytes;
+	char status[max_bytes_returned];
+};
+
+// Open devices. A handle is the slot's generation in the high 32 bits and
+// slot index + 1 in the low, so 0 is never valid and a closed device's
+// handle never matches whatever is opened in its slot next.
+typedef struct MmcSlot
+{
+	MmcDevice *device;
+	unsigned int generation;
+} MmcSlot;
+
+static MmcSlot _slots[mmc_max_devices];
+static SRWLOCK _slotLock = SRWLOCK_INIT;
+static MmcDevice _opening;                  // holds a slot while MmcOpen() runs
+
+// Caller holds _slotLock exclusive
+static void mmc_free_slot(unsigned int index)
+{
+	_slots[index].device = NULL;
+	_slots[index].generation++;
+}
+
+static void mmc_unclaim_slot(unsigned int index)
+{
+	AcquireSRWLockExclusive(&_slotLock);
+	mmc_free_slot(index);
+	ReleaseSRWLockExclusive(&_slotLock);
+}
+
+static MmcDevice *mmc_lookup(MmcHandle hMmc, bool attach)
+{
+	unsigned int index = (unsigned int)(hMmc & 0xffffffff) - 1;
+	unsigned int generation = (unsigned int)(hMmc >> 32);
+	MmcDevice *d = NULL;
+
+	if (index >= mmc_max_devices)
+		return NULL;
+	AcquireSRWLockShared(&_slotLock);
+	if (_slots[index].device != NULL && _slots[index].device != &_opening &&
+		_slots[index].generation == generation)
+	{
+		d = _slots[index].device;
+		InterlockedIncrement(&d->refs);
+		if (attach)
+			InterlockedIncrement(&d->attached);
+	}
+	ReleaseSRWLockShared(&_slotLock);
+	return d;
+}
+
+/*
+	Reference the open device for hMmc, it stays allocated until the
+	matching mmc_release() even if MmcClose() runs meanwhile; transfers
+	then fail with ERROR_INVALID_HANDLE.
+
+	Returns: device, NULL if hMmc isn't an open device
+*/
+MmcDevice *mmc_acquire(MmcHandle hMmc)
+{
+	return mmc_lookup(hMmc, false);
+}
+
+void mmc_release(MmcDevice *d)
+{
+	if (InterlockedDecrement(&d->refs) == 0)
+	{
+		DeleteCriticalSection(&d->lock);
+		free(d);
+	}
+}
+
+/*
+	mmc_acquire() for long lived users like the scheduler, MmcClose()
+	returns ERROR_BUSY until the matching mmc_detach().
+*/
+MmcDevice *mmc_attach(MmcHandle hMmc)
+{
+	return mmc_lookup(hMmc, true);
+}
+
+void mmc_detach(MmcDevice *d)
+{
+	InterlockedDecrement(&d->attached);
+	mmc_release(d);
+}
+
+/*
+	Set the device's status text, or the global one returned by
+	GetMmcStatus() when there is no device yet.
+*/
+void mmc_status(MmcDevice *d, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	if (d != NULL)
+		_vsnprintf_s(d->status, max_bytes_returned, _TRUNCATE, format, args);
+	else
+		_vsnprintf_s(_lastError, max_bytes_returned, _TRUNCATE, format, args);
+	va_end(args);
+}
+
+static DWORD mmc_io(MmcDevice *d, BYTE *data, int bytes, bool write, int *done)
+{
+	DWORD err;
+	DWORD byte_count;
+	BOOL started;
+
+	if (d->hDevice == INVALID_HANDLE_VALUE)
+	{
+		mmc_status(d, "Error %u, MMC device was closed.", ERROR_INVALID_HANDLE);
+		return ERROR_INVALID_HANDLE;
+	}
+
+	d->overlapped.Offset = 0;
+	d->overlapped.OffsetHigh = 0;
+	d->overlapped.hEvent = 0;
+
+	if (write)
+		started = WriteFile(d->hDevice, data, bytes, NULL, &d->overlapped);
+	else
+		started = ReadFile(d->hDevice, data, bytes, NULL, &d->overlapped);
+	if (!started)
+	{
+		err = GetLastError();
+		if (err != ERROR_IO_PENDING)
+		{
+			mmc_status(d, "Error %u initiating MMC %s.", err, write ? "write" : "read");
+			return err;
+		}
+	}
+
+	if (!GetOverlappedResult(d->hDevice, &d->overlapped, &byte_count, TRUE))
+	{
+		err = GetLastError();
+		mmc_status(d, "Error %u %s MMC.", err, write ? "writing to" : "reading from");
+		return err;
+	}
+
+	if (done != NULL)
+		*done = (int)byte_count;
+	if (byte_count != (DWORD)bytes)
+	{
+		mmc_status(d, "Internal error - partial %s, %u of %d bytes.", write ? "write" : "read", byte_count, bytes);
+		return ERROR_INVALID_FUNCTION;
+	}
+	return 0;
+}
+
+static bool mmc_sectors(int bytes)
+{
+	return bytes > 0 && bytes % mmc_sector_bytes == 0;
+}
+
+/*
+	Write an opcode block then read the response, holding the device lock
+	so nothing else can get between the two.
+	Either half can be skipped with a zero length.
+
+	Returns: 0 on success, else Windows error code
+*/
+DWORD mmc_transfer(MmcDevice *d, const BYTE *opcodes, int writeBytes, BYTE *response, int readBytes)
+{
+	DWORD err = 0;
+
+	EnterCriticalSection(&d->lock);
+	if (writeBytes != 0)
+		err = mmc_io(d, (BYTE *)opcodes, writeBytes, true, NULL);
+	if (err == 0 && readBytes != 0)
+		err = mmc_io(d, response, readBytes, false, NULL);
+	if (err == 0)
+		mmc_status(d, "MMC transfer successfully completed.");
+	LeaveCriticalSection(&d->lock);
+	return err;
+}
+
+/*
+	Hold the device lock across several mmc_transfer() calls, e.g. a
+	command sequence nothing else may get into. The lock is recursive.
+*/
+void mmc_lock(MmcDevice *d)
+{
+	EnterCriticalSection(&d->lock);
+}
+
+void mmc_unlock(MmcDevice *d)
+{
+	LeaveCriticalSection(&d->lock);
+}
+
+/*
+	Returns: ABI version of this DLL, mmc_abi_version
+*/
+DllExport int MmcAbiVersion()
+{
+	return mmc_abi_version;
+}
+
+/*
+	Open specified physical MMC device
+	On success, *hMmc is the device handle for the other Mmc*() calls.
+	Unlike OpenMmc() no process-wide buffer is allocated, transfers go
+	straight to & from the caller's buffers.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MmcOpen(const char *deviceName, MmcHandle *hMmc)
+{
+	DWORD err;
+	DWORD byte_count;
+	GET_LENGTH_INFORMATION length;
+
+	if (deviceName == NULL || hMmc == NULL)
+	{
+		err = 87;	// INVALID_PARAMETER
+		mmc_status(NULL, "Error %u, invalid MMC open arguments.", err);
+		return err;
+	}
+	*hMmc = 0;
+
+	// Claim a free slot up front, the placeholder keeps it ours while opening
+	unsigned int index;
+	AcquireSRWLockExclusive(&_slotLock);
+	for (index = 0; index < mmc_max_devices && _slots[index].device != NULL; index++)
+		;
+	if (index < mmc_max_devices)
+		_slots[index].device = &_opening;
+	ReleaseSRWLockExclusive(&_slotLock);
+	if (index == mmc_max_devices)
+	{
+		err = ERROR_TOO_MANY_OPEN_FILES;
+		mmc_status(NULL, "Error %u, already %d MMC devices open.", err, mmc_max_devices);
+		return err;
+	}
+
+	MmcDevice *d = (MmcDevice *)calloc(1, sizeof(MmcDevice));
+	if (d == NULL)
+	{
+		err = ERROR_NOT_ENOUGH_MEMORY;
+		mmc_status(NULL, "Error %u allocating MMC device.", err);
+		mmc_unclaim_slot(index);
+		return err;
+	}
+
+	d->hDevice = CreateFile
+	(
+		deviceName,
+		GENERIC_READ | GENERIC_WRITE,
+		0,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_NO_BUFFERING,
+		NULL
+	);
+	if (d->hDevice == INVALID_HANDLE_VALUE)
+	{
+		err = GetLastError();
+		mmc_status(NULL, "Error %u opening MMC device %s.", err, deviceName);
+		free(d);
+		mmc_unclaim_slot(index);
+		return err;
+	}
+
+	if (!DeviceIoControl(d->hDevice, FSCTL_LOCK_VOLUME, NULL, 0, NULL, 0, &byte_count, NULL))
+	{
+		err = GetLastError();
+		mmc_status(NULL, "Error %u locking MMC volume.", err);
+		CloseHandle(d->hDevice);
+		free(d);
+		mmc_unclaim_slot(index);
+		return err;
+	}
+
+	// Informational only, floppy-like media don't report a length
+	if (DeviceIoControl(d->hDevice, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0,
+		&length, sizeof(length), &byte_count, NULL))
+		d->deviceBytes = length.Length.QuadPart;
+
+	InitializeCriticalSection(&d->lock);
+	d->refs = 1;
+	mmc_status(d, "MMC device has %I64i bytes.", d->deviceBytes);
+	_snprintf_s(_lastError, max_bytes_returned, "%s", d->status);
+
+	AcquireSRWLockExclusive(&_slotLock);
+	_slots[index].device = d;
+	*hMmc = ((MmcHandle)_slots[index].generation << 32) | (index + 1);
+	ReleaseSRWLockExclusive(&_slotLock);
+	return 0;
+}
+
+/*
+	Close device, the handle is invalid afterwards. A transfer already
+	in progress on another thread finishes first.
+
+	Returns: 0 on success, ERROR_BUSY while the scheduler is using the
+	device, else Windows error code
+*/
+DllExport int MmcClose(MmcHandle hMmc)
+{
+	DWORD err = 0;
+	unsigned int index = (unsigned int)(hMmc & 0xffffffff) - 1;
+	unsigned int generation = (unsigned int)(hMmc >> 32);
+	MmcDevice *d = NULL;
+
+	if (index >= mmc_max_devices)
+		return 87;	// INVALID_PARAMETER
+	AcquireSRWLockExclusive(&_slotLock);
+	if (_slots[index].generation == generation && _slots[index].device != &_opening)
+		d = _slots[index].device;
+	if (d != NULL && d->attached > 0)
+	{
+		ReleaseSRWLockExclusive(&_slotLock);
+		err = ERROR_BUSY;
+		mmc_status(d, "Error %u, stop the scheduler before closing the MMC device.", err);
+		return err;
+	}
+	if (d != NULL)
+		mmc_free_slot(index);
+	ReleaseSRWLockExclusive(&_slotLock);
+	if (d == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	// Late users still holding a reference fail cleanly on the closed handle
+	EnterCriticalSection(&d->lock);
+	if (!CloseHandle(d->hDevice))
+		err = GetLastError();
+	d->hDevice = INVALID_HANDLE_VALUE;
+	LeaveCriticalSection(&d->lock);
+	mmc_release(d);
+
+	if (err != 0)
+		mmc_status(NULL, "Error %u closing MMC device.", err);
+	else
+		mmc_status(NULL, "MMC device closed.");
+	return err;
+}
+
+/*
+	Copy device information to *info, info->size must be set by the caller.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MmcGetInfo(MmcHandle hMmc, MmcDeviceInfo *info)
+{
+	if (info == NULL || info->size < sizeof(MmcDeviceInfo))
+		return 87;	// INVALID_PARAMETER
+	MmcDevice *d = mmc_acquire(hMmc);
+	if (d == NULL)
+		return 87;	// INVALID_PARAMETER
+
+	info->abiVersion = mmc_abi_version;
+	info->sectorBytes = mmc_sector_bytes;
+	info->reserved = 0;
+	info->deviceBytes = d->deviceBytes;
+	mmc_release(d);
+	return 0;
+}
+
+/*
+	Write an opcode block from the caller's buffer,
+	integral number of 512 byte sectors.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MmcWrite(MmcHandle hMmc, const unsigned char *data, int bytes)
+{
+	DWORD err;
+
+	MmcDevice *d = mmc_acquire(hMmc);
+	if (d == NULL)
+		return 87;	// INVALID_PARAMETER
+	if (data == NULL || !mmc_sectors(bytes))
+	{
+		err = 87;	// INVALID_PARAMETER
+		mmc_status(d, "Error %u, MMC write must be integral sector size(512).", err);
+	}
+	else
+		err = mmc_transfer(d, data, bytes, NULL, 0);
+	mmc_release(d);
+	return err;
+}
+
+/*
+	Read into the caller's buffer, integral number of 512 byte sectors.
+	*bytesRead, if not NULL, is the number of bytes actually read.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MmcRead(MmcHandle hMmc, unsigned char *data, int bytes, int *bytesRead)
+{
+	DWORD err;
+
+	MmcDevice *d = mmc_acquire(hMmc);
+	if (d == NULL)
+		return 87;	// INVALID_PARAMETER
+	if (bytesRead != NULL)
+		*bytesRead = 0;
+	if (data == NULL || !mmc_sectors(bytes))
+	{
+		err = 87;	// INVALID_PARAMETER
+		mmc_status(d, "Error %u, MMC read must be integral sector size(512).", err);
+		mmc_release(d);
+		return err;
+	}
+
+	EnterCriticalSection(&d->lock);
+	err = mmc_io(d, data, bytes, false, bytesRead);
+	if (err == 0)
+		mmc_status(d, "Read MMC successfully completed.");
+	LeaveCriticalSection(&d->lock);
+	mmc_release(d);
+	return err;
+}
+
+/*
+	Write an opcode block and read the response in one call, the usual
+	command/response cycle with a single managed to native transition.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int MmcTransfer(MmcHandle hMmc, const unsigned char *opcodes, int writeBytes,
+	unsigned char *response, int readBytes)
+{
+	DWORD err;
+
+	MmcDevice *d = mmc_acquire(hMmc);
+	if (d == NULL)
+		return 87;	// INVALID_PARAMETER
+	if (opcodes == NULL || response == NULL || !mmc_sectors(writeBytes) || !mmc_sectors(readBytes))
+	{
+		err = 87;	// INVALID_PARAMETER
+		mmc_status(d, "Error %u, MMC transfer must be integral sector size(512).", err);
+	}
+	else
+		err = mmc_transfer(d, opcodes, writeBytes, response, readBytes);
+	mmc_release(d);
+	return err;
+}
+
+static int mmc_copy_status(const char *text, char *status, int bytes)
+{
+	size_t length = strlen(text);
+	strncpy_s(status, bytes, text, _TRUNCATE);
+	return length < (size_t)bytes ? 0 : ERROR_INSUFFICIENT_BUFFER;
+}
+
+/*
+	Copy the device's last status text into the caller's buffer.
+	hMmc of 0 gets the global status, e.g. why MmcOpen() failed.
+
+	Returns: 0 on success, ERROR_INSUFFICIENT_BUFFER if the text was truncated
+*/
+DllExport int MmcGetStatus(MmcHandle hMmc, char *status, int bytes)
+{
+	if (status == NULL || bytes <= 0)
+		return 87;	// INVALID_PARAMETER
+	if (hMmc == 0)
+		return mmc_copy_status(_lastError, status, bytes);
+
+	MmcDevice *d = mmc_acquire(hMmc);
+	if (d == NULL)
+		return 87;	// INVALID_PARAMETER
+	int err = mmc_copy_status(d->status, status, bytes);
+	mmc_release(d);
+	return err;
+}
@@ -0,0 +1,59 @@
+//
+// mmc_io_v2.h : Version 2 of the MMC device ABI.
+//
+// Every argument is blittable: handles are 64 bit slot & generation
+// numbers, never pointers, so a closed or made up handle is rejected
+// with INVALID_PARAMETER instead of being dereferenced. Status text
+// and transfer data go through caller-owned pointer + length buffers, so
+// a managed caller can pass a pinned byte[] straight through without any
+// marshaling copies or CoTaskMemAlloc'd returns. Each open device has its
+// own OVERLAPPED, lock & status text. Every call on a device, including
+// the ones the native scheduler and leveler make, takes the device lock.
+// The FPGA holds a new block until the last response has been read, so a
+// caller sharing the device with them must use MmcTransfer() for each
+// command/response cycle; another block can land between separate
+// MmcWrite() & MmcRead() calls. Only the version 2 exports are serialized
+// this way, don't mix in the version 1 calls.
+//
+// The version 1 exports in mmc_io.cpp are unchanged.
+//
+#pragma once
+
+#include "mmc_io.h"
+
+#define mmc_abi_version 2
+#define mmc_sector_bytes 512
+
+typedef unsigned long long MmcHandle;       // 0 is never a valid handle
+
+// Set size to sizeof(MmcDeviceInfo) before calling MmcGetInfo()
+typedef struct MmcDeviceInfo
+{
+	unsigned int size;
+	unsigned int abiVersion;
+	unsigned int sectorBytes;
+	unsigned int reserved;
+	long long deviceBytes;
+} MmcDeviceInfo;
+
+DllExport int MmcAbiVersion();
+DllExport int MmcOpen(const char *deviceName, MmcHandle *hMmc);
+DllExport int MmcClose(MmcHandle hMmc);
+DllExport int MmcGetInfo(MmcHandle hMmc, MmcDeviceInfo *info);
+DllExport int MmcWrite(MmcHandle hMmc, const unsigned char *data, int bytes);
+DllExport int MmcRead(MmcHandle hMmc, unsigned char *data, int bytes, int *bytesRead);
+DllExport int MmcTransfer(MmcHandle hMmc, const unsigned char *opcodes, int writeBytes,
+	unsigned char *response, int readBytes);
+DllExport int MmcGetStatus(MmcHandle hMmc, char *status, int bytes);
+
+// For the other mmc_io translation units
+typedef struct MmcDevice MmcDevice;
+
+MmcDevice *mmc_acquire(MmcHandle hMmc);
+void mmc_release(MmcDevice *d);
+MmcDevice *mmc_attach(MmcHandle hMmc);
+void mmc_detach(MmcDevice *d);
+DWORD mmc_transfer(MmcDevice *d, const BYTE *opcodes, int writeBytes, BYTE *response, int readBytes);
+void mmc_lock(MmcDevice *d);
+void mmc_unlock(MmcDevice *d);
+void mmc_status(MmcDevice *d, const char *format, ...);
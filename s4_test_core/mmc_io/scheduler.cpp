@@ -0,0 +1,439 @@
+//
+// scheduler.cpp : Host-side timed opcode scheduler, see scheduler.h
+//
+#include "stdafx.h"
+#include "scheduler.h"
+
+#include <malloc.h>
+#include <mmsystem.h>
+#include <queue>
+#include <vector>
+
+#pragma comment(lib, "winmm.lib")
+
+#define rsp_success 0x01                // FPGA status.h SUCCESS, 1st response byte
+
+typedef struct SchedEntry
+{
+	long long deadline;                 // performance counter ticks
+	unsigned int sequence;              // keeps equal deadlines in queued order
+	BYTE *data;                         // sector aligned, empty 1st sector then the opcode block
+	int bytes;                          // including the empty 1st sector
+} SchedEntry;
+
+struct SchedLater
+{
+	bool operator()(const SchedEntry &a, const SchedEntry &b) const
+	{
+		if (a.deadline != b.deadline)
+			return a.deadline > b.deadline;
+		return a.sequence > b.sequence;
+	}
+};
+
+static std::priority_queue<SchedEntry, std::vector<SchedEntry>, SchedLater> _queue;
+static CRITICAL_SECTION _lock;
+static HANDLE _hWake;                   // auto-reset, new entry or stop request
+static HANDLE _hThread;
+static MmcDevice *_schedMmc;
+static BYTE *_response;                 // sched_rsp_bytes, sector aligned
+static volatile LONG _stopping;
+static unsigned int _sequence;
+static SchedStats _stats;
+static double _sumLateUs;
+static double _sumCycleUs;
+
+static long long qpc_frequency()
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+}
+
+static long long ticks_per_second()
+{
+	static const long long freq = qpc_frequency();
+	return freq;
+}
+
+long long sched_ticks()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+// Split into whole seconds & remainder so the multiply can't overflow
+long long sched_us_to_ticks(long long us)
+{
+	long long freq = ticks_per_second();
+	return (us / 1000000) * freq + ((us % 1000000) * freq) / 1000000;
+}
+
+double sched_ticks_to_us(long long ticks)
+{
+	return (double)ticks * 1.0e6 / (double)ticks_per_second();
+}
+
+/*
+	Hybrid sleep/spin wait. Sleeps in 1ms steps until sched_spin_us before
+	the deadline, then spins on the performance counter.
+	If hWake is signalled while sleeping we return early.
+
+	Returns: true when the deadline was reached, false if woken early
+*/
+bool sched_wait_until(long long deadlineTicks, HANDLE hWake)
+{
+	long long spin = sched_us_to_ticks(sched_spin_us);
+	for (;;)
+	{
+		long long remaining = deadlineTicks - sched_ticks();
+		if (remaining <= spin)
+			break;
+		DWORD ms = (DWORD)(sched_ticks_to_us(remaining - spin) / 1000.0);
+		if (ms == 0)
+			break;
+		if (hWake != NULL)
+		{
+			if (WaitForSingleObject(hWake, ms) == WAIT_OBJECT_0)
+				return false;
+		}
+		else
+			Sleep(ms);
+	}
+	while (sched_ticks() < deadlineTicks)
+		YieldProcessor();
+	return true;
+}
+
+static void sched_clear_stats()
+{
+	memset(&_stats, 0, sizeof(_stats));
+	_sumLateUs = 0.0;
+	_sumCycleUs = 0.0;
+}
+
+static void sched_record(double lateUs, double cycleUs, DWORD err)
+{
+	EnterCriticalSection(&_lock);
+	if (err != 0)
+	{
+		_stats.errors++;
+		_stats.lastError = err;
+	}
+	else
+	{
+		if (_stats.dispatched == 0 || lateUs < _stats.minLateUs)
+			_stats.minLateUs = lateUs;
+		if (_stats.dispatched == 0 || lateUs > _stats.maxLateUs)
+			_stats.maxLateUs = lateUs;
+		if (cycleUs > _stats.maxCycleUs)
+			_stats.maxCycleUs = cycleUs;
+		_sumLateUs += lateUs;
+		_sumCycleUs += cycleUs;
+		_stats.dispatched++;
+		_stats.meanLateUs = _sumLateUs / _stats.dispatched;
+		_stats.meanCycleUs = _sumCycleUs / _stats.dispatched;
+
+		int bin = lateUs <= 0.0 ? 0 : (int)(lateUs / sched_hist_bin_us);
+		if (bin >= sched_hist_bins)
+			bin = sched_hist_bins - 1;
+		_stats.histogram[bin]++;
+
+		bin = (int)(cycleUs / sched_cycle_bin_us);
+		if (bin >= sched_hist_bins)
+			bin = sched_hist_bins - 1;
+		_stats.cycleHistogram[bin]++;
+	}
+	LeaveCriticalSection(&_lock);
+}
+
+/*
+	Write the block & read its response under the device lock, as RunCmd().
+
+	Returns: 0 on success, Windows error code if the transfer failed, else
+	the response status byte if it wasn't SUCCESS
+*/
+static DWORD sched_run(BYTE *data, int bytes)
+{
+	DWORD err = mmc_transfer(_schedMmc, data, bytes, _response, sched_rsp_bytes);
+	if (err != 0)
+		return err;
+	if (_response[mmc_sector_bytes] != rsp_success)
+		return _response[mmc_sector_bytes];
+	return 0;
+}
+
+static DWORD WINAPI sched_thread(LPVOID)
+{
+	while (!_stopping)
+	{
+		EnterCriticalSection(&_lock);
+		if (_queue.empty())
+		{
+			LeaveCriticalSection(&_lock);
+			WaitForSingleObject(_hWake, INFINITE);
+			continue;
+		}
+		long long deadline = _queue.top().deadline;
+		LeaveCriticalSection(&_lock);
+
+		// Woken early means an earlier entry or a stop, look again
+		if (!sched_wait_until(deadline, _hWake))
+			continue;
+
+		EnterCriticalSection(&_lock);
+		SchedEntry next = _queue.top();
+		_queue.pop();
+		LeaveCriticalSection(&_lock);
+
+		long long start = sched_ticks();
+		DWORD err = sched_run(next.data, next.bytes);
+		long long done = sched_ticks();
+		_aligned_free(next.data);
+
+		if (err != 0)
+			_snprintf_s(_lastError, max_bytes_returned, "Error %u on scheduled MMC transfer.", err);
+		sched_record(sched_ticks_to_us(start - next.deadline), sched_ticks_to_us(done - start), err);
+	}
+	return 0;
+}
+
+/*
+	Start the dispatch thread for an MMC device opened with MmcOpen().
+	MmcClose() returns ERROR_BUSY for that device until SchedStop().
+	cpu is the processor to pin the thread to, -1 to let Windows choose,
+	and must be below the bit count of an affinity mask.
+	The thread runs at THREAD_PRIORITY_TIME_CRITICAL and the system timer
+	is set to 1ms while the scheduler runs.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int SchedStart(MmcHandle hMmc, int cpu)
+{
+	DWORD err;
+
+	if (_hThread != NULL)
+	{
+		err = ERROR_ALREADY_INITIALIZED;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, scheduler already running.", err);
+		return err;
+	}
+
+	if (cpu >= (int)(8 * sizeof(DWORD_PTR)))
+	{
+		err = 87;	// INVALID_PARAMETER
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, no affinity mask bit for cpu %d.", err, cpu);
+		return err;
+	}
+
+	MmcDevice *d = mmc_attach(hMmc);
+	if (d == NULL)
+	{
+		err = ERROR_INVALID_HANDLE;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, scheduler needs an MmcOpen() device handle.", err);
+		return err;
+	}
+
+	_response = (BYTE *)_aligned_malloc(sched_rsp_bytes, mmc_sector_bytes);
+	if (_response == NULL)
+	{
+		err = ERROR_NOT_ENOUGH_MEMORY;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u allocating scheduler response buffer.", err);
+		mmc_detach(d);
+		return err;
+	}
+
+	InitializeCriticalSection(&_lock);
+	_hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (_hWake == NULL)
+	{
+		err = GetLastError();
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u creating scheduler event.", err);
+		DeleteCriticalSection(&_lock);
+		_aligned_free(_response);
+		_response = NULL;
+		mmc_detach(d);
+		return err;
+	}
+
+	_schedMmc = d;
+	_stopping = 0;
+	_sequence = 0;
+	sched_clear_stats();
+	timeBeginPeriod(1);
+
+	_hThread = CreateThread(NULL, 0, sched_thread, NULL, CREATE_SUSPENDED, NULL);
+	if (_hThread == NULL)
+	{
+		err = GetLastError();
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u creating scheduler thread.", err);
+		timeEndPeriod(1);
+		CloseHandle(_hWake);
+		DeleteCriticalSection(&_lock);
+		_aligned_free(_response);
+		_response = NULL;
+		mmc_detach(d);
+		return err;
+	}
+
+	SetThreadPriority(_hThread, THREAD_PRIORITY_TIME_CRITICAL);
+	if (cpu >= 0 && !SetThreadAffinityMask(_hThread, (DWORD_PTR)1 << cpu))
+	{
+		err = GetLastError();
+		_stopping = 1;
+		ResumeThread(_hThread);
+		SchedStop();
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u pinning scheduler to cpu %d.", err, cpu);
+		return err;
+	}
+	ResumeThread(_hThread);
+
+	_snprintf_s(_lastError, max_bytes_returned, "Scheduler started.");
+	return 0;
+}
+
+/*
+	Stop the dispatch thread, anything still queued is discarded.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int SchedStop()
+{
+	if (_hThread == NULL)
+		return 0;
+
+	InterlockedExchange(&_stopping, 1);
+	SetEvent(_hWake);
+	WaitForSingleObject(_hThread, INFINITE);
+	CloseHandle(_hThread);
+	_hThread = NULL;
+
+	unsigned int discarded = (unsigned int)_queue.size();
+	while (!_queue.empty())
+	{
+		_aligned_free(_queue.top().data);
+		_queue.pop();
+	}
+
+	timeEndPeriod(1);
+	CloseHandle(_hWake);
+	_hWake = NULL;
+	DeleteCriticalSection(&_lock);
+	_aligned_free(_response);
+	_response = NULL;
+	mmc_detach(_schedMmc);
+	_schedMmc = NULL;
+
+	_snprintf_s(_lastError, max_bytes_returned, "Scheduler stopped, %u opcode blocks discarded.", discarded);
+	return 0;
+}
+
+/*
+	Scheduler time base, use this to compute deadlines for SchedQueue()
+
+	Returns: performance counter time in microseconds
+*/
+DllExport long long SchedNow()
+{
+	long long ticks = sched_ticks();
+	long long freq = ticks_per_second();
+	return (ticks / freq) * 1000000 + ((ticks % freq) * 1000000) / freq;
+}
+
+/*
+	Queue an opcode block to run at deadlineUs (SchedNow() time base).
+	Same block as RunCmd() takes, integral number of 512 byte sectors; the
+	scheduler puts it in the 2nd sector & reads the response.
+	Deadlines in the past are dispatched immediately.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int SchedQueue(const unsigned char *data, int bytes, long long deadlineUs)
+{
+	DWORD err;
+
+	if (_hThread == NULL)
+	{
+		err = ERROR_NOT_READY;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, scheduler not running.", err);
+		return err;
+	}
+	if (data == NULL || bytes == 0 || bytes % 512 != 0)
+	{
+		err = 87;	// INVALID_PARAMETER
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, MMC write must be integral sector size(512).", err);
+		return err;
+	}
+
+	SchedEntry entry;
+	entry.deadline = sched_us_to_ticks(deadlineUs);
+	entry.bytes = mmc_sector_bytes + bytes;
+	entry.data = (BYTE *)_aligned_malloc(entry.bytes, mmc_sector_bytes);
+	if (entry.data == NULL)
+	{
+		err = ERROR_NOT_ENOUGH_MEMORY;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u allocating scheduler entry.", err);
+		return err;
+	}
+	memset(entry.data, 0, mmc_sector_bytes);
+	memcpy(entry.data + mmc_sector_bytes, data, bytes);
+
+	EnterCriticalSection(&_lock);
+	if (_queue.size() >= sched_max_queued)
+	{
+		LeaveCriticalSection(&_lock);
+		_aligned_free(entry.data);
+		err = ERROR_BUSY;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, scheduler queue full(%d).", err, sched_max_queued);
+		return err;
+	}
+	entry.sequence = _sequence++;
+	_queue.push(entry);
+	LeaveCriticalSection(&_lock);
+
+	SetEvent(_hWake);
+	return 0;
+}
+
+/*
+	Copy the dispatch timing statistics
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int SchedGetStats(SchedStats *stats)
+{
+	if (stats == NULL)
+		return 87;	// INVALID_PARAMETER
+	if (_hThread == NULL)
+	{
+		memcpy(stats, &_stats, sizeof(_stats));
+		stats->pending = 0;
+		return 0;
+	}
+
+	EnterCriticalSection(&_lock);
+	memcpy(stats, &_stats, sizeof(_stats));
+	stats->pending = (unsigned int)_queue.size();
+	LeaveCriticalSection(&_lock);
+	return 0;
+}
+
+/*
+	Clear the dispatch timing statistics
+
+	Returns: 0
+*/
+DllExport int SchedResetStats()
+{
+	if (_hThread == NULL)
+	{
+		sched_clear_stats();
+		return 0;
+	}
+
+	EnterCriticalSection(&_lock);
+	sched_clear_stats();
+	LeaveCriticalSection(&_lock);
+	return 0;
+}
@@ -0,0 +1,60 @@
+//
+// scheduler.h : Host-side timed opcode scheduler.
+//
+// Opcode blocks are queued with an absolute deadline (SchedNow() time base,
+// microseconds) and run on the MMC device by a dedicated time-critical
+// thread. The thread sleeps until shortly before the deadline, then spins
+// on the performance counter so dispatch jitter is microseconds rather than
+// the tens of milliseconds we get from Thread.Sleep in the managed code.
+//
+// Each dispatch is a full command/response cycle in the same framing as the
+// managed RunCmd(), opcodes in the 2nd sector & a 1024 byte response read,
+// through mmc_transfer() so it holds the device lock. The FPGA won't start
+// the next opcode block until the response is read, and nothing else can
+// get between another caller's write & read.
+//
+#pragma once
+
+#include "mmc_io_v2.h"
+
+#define sched_hist_bins 128             // last bin collects everything later than the others
+#define sched_hist_bin_us 10            // width of each lateness histogram bin
+#define sched_cycle_bin_us 50           // width of each cycle time histogram bin
+#define sched_max_queued 4096           // opcode blocks waiting for dispatch
+#define sched_spin_us 1500              // stop sleeping & start spinning this far from deadline
+#define sched_rsp_bytes 1024            // response read after every block, as RunCmd()
+
+// Achieved-versus-target dispatch timing, all times in microseconds.
+// Lateness is from the deadline to the start of the dispatch, when the
+// thread stops spinning & goes for the device. Cycle time is from there to
+// the response being read, so it includes any wait for the device lock as
+// well as the write/read itself. histogram[n] counts dispatches that were
+// n*sched_hist_bin_us to (n+1)*sched_hist_bin_us late, cycleHistogram[n]
+// those whose cycle took n*sched_cycle_bin_us to (n+1)*sched_cycle_bin_us.
+typedef struct SchedStats
+{
+	unsigned int dispatched;            // opcode blocks run
+	unsigned int errors;                // transfer failures & non-SUCCESS responses
+	unsigned int lastError;             // Windows error code, or response status byte, of last failure
+	unsigned int pending;               // opcode blocks still queued
+	double minLateUs;                   // best deadline error
+	double maxLateUs;                   // worst deadline error
+	double meanLateUs;                  // average deadline error
+	double maxCycleUs;                  // longest MMC write/read cycle
+	double meanCycleUs;                 // average MMC write/read cycle
+	unsigned int histogram[sched_hist_bins];
+	unsigned int cycleHistogram[sched_hist_bins];
+} SchedStats;
+
+DllExport int SchedStart(MmcHandle hMmc, int cpu);
+DllExport int SchedStop();
+DllExport long long SchedNow();
+DllExport int SchedQueue(const unsigned char *data, int bytes, long long deadlineUs);
+DllExport int SchedGetStats(SchedStats *stats);
+DllExport int SchedResetStats();
+
+// Performance counter helpers shared with the other native loops
+long long sched_ticks();
+long long sched_us_to_ticks(long long us);
+double sched_ticks_to_us(long long ticks);
+bool sched_wait_until(long long deadlineTicks, HANDLE hWake);
@@ -0,0 +1,517 @@
+//
+// zmon.cpp : Host-side ZMON/ADC conversion kernels, see zmon.h
+//
+// The SSE2 & AVX2 kernels are the scalar reference unrolled across lanes.
+// Keep every floating point step in the same order in all three, and keep
+// /fp:precise without /arch:AVX2 on this file so nothing is fused into an
+// FMA, or the kernels stop agreeing bit for bit.
+//
+#include "stdafx.h"
+#include "zmon.h"
+
+#include <float.h>
+#include <intrin.h>
+#include <immintrin.h>
+#include <math.h>
+
+static const float zmon_volts_lsb = 1.0f / 65536.0f;        // Q15.16
+static const float zmon_mw_per_v2 = 20.0f;                  // 1000 / 50 ohms
+static const float zmon_min_mw = 1.0e-20f;                  // keeps log() finite
+static const float zmon_sqrt2 = 1.41421356f;
+static const float zmon_db_per_octave = 3.01029996f;        // 10 * log10(2)
+static const float zmon_db_per_neper = 4.34294482f;         // 10 / ln(10)
+static const float zmon_tan_pi_8 = 0.414213562f;
+static const float zmon_pi_4 = 0.785398163f;
+static const float zmon_pi_2 = 1.57079633f;
+static const float zmon_pi = 3.14159265f;
+static const float zmon_deg_per_rad = 57.2957795f;
+
+// ln(m) = 2 * (t + t^3/3 + t^5/5 + ...), t = (m-1)/(m+1), |t| <= 0.172
+static const float zmon_ln_c3 = 0.333333333f;
+static const float zmon_ln_c5 = 0.2f;
+static const float zmon_ln_c7 = 0.142857143f;
+static const float zmon_ln_c9 = 0.111111111f;
+
+// atan(x) = x - x^3/3 + x^5/5 - ..., |x| <= tan(pi/8)
+static const float zmon_atan_c3 = -0.333333333f;
+static const float zmon_atan_c5 = 0.2f;
+static const float zmon_atan_c7 = -0.142857143f;
+static const float zmon_atan_c9 = 0.111111111f;
+static const float zmon_atan_c11 = -0.0909090909f;
+static const float zmon_atan_c13 = 0.0769230769f;
+static const float zmon_atan_c15 = -0.0666666667f;
+
+//
+// Scalar reference
+//
+
+// meas_calcs CAL1..CAL5, low 32 bits of the signed product
+static int zmon_volts(int raw, int offset, int gain)
+{
+	return (int)((unsigned int)(raw + offset) * (unsigned int)gain);
+}
+
+float zmon_db(float sumsq)
+{
+	float mw = sumsq * zmon_mw_per_v2;
+	mw = mw > zmon_min_mw ? mw : zmon_min_mw;
+
+	unsigned int bits;
+	memcpy(&bits, &mw, sizeof(bits));
+	int e = (int)((bits >> 23) & 0xff) - 127;
+	bits = (bits & 0x007fffff) | 0x3f800000;
+	float m;
+	memcpy(&m, &bits, sizeof(m));
+	if (m > zmon_sqrt2)
+	{
+		m = m * 0.5f;
+		e = e + 1;
+	}
+
+	float t = (m - 1.0f) / (m + 1.0f);
+	float t2 = t * t;
+	float poly = zmon_ln_c9;
+	poly = poly * t2 + zmon_ln_c7;
+	poly = poly * t2 + zmon_ln_c5;
+	poly = poly * t2 + zmon_ln_c3;
+	poly = poly * t2 + 1.0f;
+	float ln = (t + t) * poly;
+	return (float)e * zmon_db_per_octave + ln * zmon_db_per_neper;
+}
+
+static float zmon_phase(float vi, float vq)
+{
+	float ax = fabsf(vi);
+	float ay = fabsf(vq);
+	float mx = ax > ay ? ax : ay;
+	float mn = ax < ay ? ax : ay;
+	mx = mx > FLT_MIN ? mx : FLT_MIN;
+	float a = mn / mx;
+
+	bool reduce = a > zmon_tan_pi_8;
+	float x = reduce ? (a - 1.0f) / (a + 1.0f) : a;
+	float x2 = x * x;
+	float poly = zmon_atan_c15;
+	poly = poly * x2 + zmon_atan_c13;
+	poly = poly * x2 + zmon_atan_c11;
+	poly = poly * x2 + zmon_atan_c9;
+	poly = poly * x2 + zmon_atan_c7;
+	poly = poly * x2 + zmon_atan_c5;
+	poly = poly * x2 + zmon_atan_c3;
+	poly = poly * x2 + 1.0f;
+	float r = x * poly;
+	r = r + (reduce ? zmon_pi_4 : 0.0f);
+
+	if (ay > ax)
+		r = zmon_pi_2 - r;
+	if (vi < 0.0f)
+		r = zmon_pi - r;
+	if (vq < 0.0f)
+		r = -r;
+	return r * zmon_deg_per_rad;
+}
+
+static bool zmon_wants_float(const ZmonResults *r)
+{
+	return r->fwdMag || r->rflMag || r->fwdPhase || r->rflPhase ||
+		r->fwdDbm || r->rflDbm || r->returnLoss;
+}
+
+static void zmon_scalar_range(const ZmonCal *cal, const unsigned int *adcf,
+	const unsigned int *adcr, int start, int count, ZmonResults *r)
+{
+	bool wantFloat = zmon_wants_float(r);
+	bool wantDb = r->fwdDbm || r->rflDbm || r->returnLoss;
+
+	for (int k = start; k < count; k++)
+	{
+		unsigned int wf = adcf[k];
+		unsigned int wr = adcr[k];
+		if (r->adcf)
+			r->adcf[k] = (wf << 16) | (wf >> 16);
+		if (r->adcr)
+			r->adcr[k] = (wr << 16) | (wr >> 16);
+
+		int fi = zmon_volts((short)(wf >> 16), cal->fwdIOffset, cal->fwdIGain);
+		int fq = zmon_volts((short)(wf & 0xffff), cal->fwdQOffset, cal->fwdQGain);
+		int ri = zmon_volts((short)(wr >> 16), cal->rflIOffset, cal->rflIGain);
+		int rq = zmon_volts((short)(wr & 0xffff), cal->rflQOffset, cal->rflQGain);
+		if (r->fwdIVolts)
+			r->fwdIVolts[k] = fi;
+		if (r->fwdQVolts)
+			r->fwdQVolts[k] = fq;
+		if (r->rflIVolts)
+			r->rflIVolts[k] = ri;
+		if (r->rflQVolts)
+			r->rflQVolts[k] = rq;
+		if (!wantFloat)
+			continue;
+
+		float vfi = (float)fi * zmon_volts_lsb;
+		float vfq = (float)fq * zmon_volts_lsb;
+		float vri = (float)ri * zmon_volts_lsb;
+		float vrq = (float)rq * zmon_volts_lsb;
+		float fsum = vfi * vfi + vfq * vfq;
+		float rsum = vri * vri + vrq * vrq;
+		if (r->fwdMag)
+			r->fwdMag[k] = sqrtf(fsum);
+		if (r->rflMag)
+			r->rflMag[k] = sqrtf(rsum);
+		if (r->fwdPhase)
+			r->fwdPhase[k] = zmon_phase(vfi, vfq);
+		if (r->rflPhase)
+			r->rflPhase[k] = zmon_phase(vri, vrq);
+		if (wantDb)
+		{
+			float fdb = zmon_db(fsum);
+			float rdb = zmon_db(rsum);
+			if (r->fwdDbm)
+				r->fwdDbm[k] = fdb;
+			if (r->rflDbm)
+				r->rflDbm[k] = rdb;
+			if (r->returnLoss)
+				r->returnLoss[k] = fdb - rdb;
+		}
+	}
+}
+
+//
+// SSE2, 4 samples per pass
+//
+
+// Low 32 bits of each 32x32 product, SSE2 has no pmulld
+static __m128i zmon_mullo_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static __m128 zmon_select_sse2(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static __m128 zmon_db_sse2(__m128 sumsq)
+{
+	__m128 mw = _mm_max_ps(_mm_mul_ps(sumsq, _mm_set1_ps(zmon_mw_per_v2)), _mm_set1_ps(zmon_min_mw));
+
+	__m128i bits = _mm_castps_si128(mw);
+	__m128i e = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)), _mm_set1_epi32(127));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+	__m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(zmon_sqrt2));
+	m = zmon_select_sse2(big, _mm_mul_ps(m, _mm_set1_ps(0.5f)), m);
+	e = _mm_sub_epi32(e, _mm_castps_si128(big));
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+	__m128 t2 = _mm_mul_ps(t, t);
+	__m128 poly = _mm_set1_ps(zmon_ln_c9);
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), _mm_set1_ps(zmon_ln_c7));
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), _mm_set1_ps(zmon_ln_c5));
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), _mm_set1_ps(zmon_ln_c3));
+	poly = _mm_add_ps(_mm_mul_ps(poly, t2), one);
+	__m128 ln = _mm_mul_ps(_mm_add_ps(t, t), poly);
+	return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(e), _mm_set1_ps(zmon_db_per_octave)),
+		_mm_mul_ps(ln, _mm_set1_ps(zmon_db_per_neper)));
+}
+
+static __m128 zmon_phase_sse2(__m128 vi, __m128 vq)
+{
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 ax = _mm_andnot_ps(sign, vi);
+	__m128 ay = _mm_andnot_ps(sign, vq);
+	__m128 mx = _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FLT_MIN));
+	__m128 a = _mm_div_ps(_mm_min_ps(ax, ay), mx);
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 reduce = _mm_cmpgt_ps(a, _mm_set1_ps(zmon_tan_pi_8));
+	__m128 x = zmon_select_sse2(reduce, _mm_div_ps(_mm_sub_ps(a, one), _mm_add_ps(a, one)), a);
+	__m128 x2 = _mm_mul_ps(x, x);
+	__m128 poly = _mm_set1_ps(zmon_atan_c15);
+	poly = _mm_add_ps(_mm_mul_ps(poly, x2), _mm_set1_ps(zmon_atan_c13));
+	poly = _mm_add_ps(_mm_mul_ps(poly, x2), _mm_set1_ps(zmon_atan_c11));
+	poly = _mm_add_ps(_mm_mul_ps(poly, x2), _mm_set1_ps(zmon_atan_c9));
+	poly = _mm_add_ps(_mm_mul_ps(poly, x2), _mm_set1_ps(zmon_atan_c7));
+	poly = _mm_add_ps(_mm_mul_ps(poly, x2), _mm_set1_ps(zmon_atan_c5));
+	poly = _mm_add_ps(_mm_mul_ps(poly, x2), _mm_set1_ps(zmon_atan_c3));
+	poly = _mm_add_ps(_mm_mul_ps(poly, x2), one);
+	__m128 r = _mm_mul_ps(x, poly);
+	r = _mm_add_ps(r, _mm_and_ps(reduce, _mm_set1_ps(zmon_pi_4)));
+
+	__m128 zero = _mm_setzero_ps();
+	r = zmon_select_sse2(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(zmon_pi_2), r), r);
+	r = zmon_select_sse2(_mm_cmplt_ps(vi, zero), _mm_sub_ps(_mm_set1_ps(zmon_pi), r), r);
+	r = _mm_xor_ps(r, _mm_and_ps(_mm_cmplt_ps(vq, zero), sign));
+	return _mm_mul_ps(r, _mm_set1_ps(zmon_deg_per_rad));
+}
+
+static void zmon_sse2_range(const ZmonCal *cal, const unsigned int *adcf,
+	const unsigned int *adcr, int count, ZmonResults *r)
+{
+	bool wantFloat = zmon_wants_float(r);
+	bool wantDb = r->fwdDbm || r->rflDbm || r->returnLoss;
+	__m128i fiOffset = _mm_set1_epi32(cal->fwdIOffset);
+	__m128i fqOffset = _mm_set1_epi32(cal->fwdQOffset);
+	__m128i riOffset = _mm_set1_epi32(cal->rflIOffset);
+	__m128i rqOffset = _mm_set1_epi32(cal->rflQOffset);
+	__m128i fiGain = _mm_set1_epi32(cal->fwdIGain);
+	__m128i fqGain = _mm_set1_epi32(cal->fwdQGain);
+	__m128i riGain = _mm_set1_epi32(cal->rflIGain);
+	__m128i rqGain = _mm_set1_epi32(cal->rflQGain);
+	__m128 lsb = _mm_set1_ps(zmon_volts_lsb);
+
+	int k = 0;
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128i wf = _mm_loadu_si128((const __m128i *)(adcf + k));
+		__m128i wr = _mm_loadu_si128((const __m128i *)(adcr + k));
+		if (r->adcf)
+			_mm_storeu_si128((__m128i *)(r->adcf + k), _mm_or_si128(_mm_slli_epi32(wf, 16), _mm_srli_epi32(wf, 16)));
+		if (r->adcr)
+			_mm_storeu_si128((__m128i *)(r->adcr + k), _mm_or_si128(_mm_slli_epi32(wr, 16), _mm_srli_epi32(wr, 16)));
+
+		__m128i fi = zmon_mullo_sse2(_mm_add_epi32(_mm_srai_epi32(wf, 16), fiOffset), fiGain);
+		__m128i fq = zmon_mullo_sse2(_mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(wf, 16), 16), fqOffset), fqGain);
+		__m128i ri = zmon_mullo_sse2(_mm_add_epi32(_mm_srai_epi32(wr, 16), riOffset), riGain);
+		__m128i rq = zmon_mullo_sse2(_mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(wr, 16), 16), rqOffset), rqGain);
+		if (r->fwdIVolts)
+			_mm_storeu_si128((__m128i *)(r->fwdIVolts + k), fi);
+		if (r->fwdQVolts)
+			_mm_storeu_si128((__m128i *)(r->fwdQVolts + k), fq);
+		if (r->rflIVolts)
+			_mm_storeu_si128((__m128i *)(r->rflIVolts + k), ri);
+		if (r->rflQVolts)
+			_mm_storeu_si128((__m128i *)(r->rflQVolts + k), rq);
+		if (!wantFloat)
+			continue;
+
+		__m128 vfi = _mm_mul_ps(_mm_cvtepi32_ps(fi), lsb);
+		__m128 vfq = _mm_mul_ps(_mm_cvtepi32_ps(fq), lsb);
+		__m128 vri = _mm_mul_ps(_mm_cvtepi32_ps(ri), lsb);
+		__m128 vrq = _mm_mul_ps(_mm_cvtepi32_ps(rq), lsb);
+		__m128 fsum = _mm_add_ps(_mm_mul_ps(vfi, vfi), _mm_mul_ps(vfq, vfq));
+		__m128 rsum = _mm_add_ps(_mm_mul_ps(vri, vri), _mm_mul_ps(vrq, vrq));
+		if (r->fwdMag)
+			_mm_storeu_ps(r->fwdMag + k, _mm_sqrt_ps(fsum));
+		if (r->rflMag)
+			_mm_storeu_ps(r->rflMag + k, _mm_sqrt_ps(rsum));
+		if (r->fwdPhase)
+			_mm_storeu_ps(r->fwdPhase + k, zmon_phase_sse2(vfi, vfq));
+		if (r->rflPhase)
+			_mm_storeu_ps(r->rflPhase + k, zmon_phase_sse2(vri, vrq));
+		if (wantDb)
+		{
+			__m128 fdb = zmon_db_sse2(fsum);
+			__m128 rdb = zmon_db_sse2(rsum);
+			if (r->fwdDbm)
+				_mm_storeu_ps(r->fwdDbm + k, fdb);
+			if (r->rflDbm)
+				_mm_storeu_ps(r->rflDbm + k, rdb);
+			if (r->returnLoss)
+				_mm_storeu_ps(r->returnLoss + k, _mm_sub_ps(fdb, rdb));
+		}
+	}
+	zmon_scalar_range(cal, adcf, adcr, k, count, r);
+}
+
+//
+// AVX2, 8 samples per pass
+//
+
+static __m256 zmon_db_avx2(__m256 sumsq)
+{
+	__m256 mw = _mm256_max_ps(_mm256_mul_ps(sumsq, _mm256_set1_ps(zmon_mw_per_v2)), _mm256_set1_ps(zmon_min_mw));
+
+	__m256i bits = _mm256_castps_si256(mw);
+	__m256i e = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)), _mm256_set1_epi32(127));
+	__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+	__m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(zmon_sqrt2), _CMP_GT_OQ);
+	m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+	e = _mm256_sub_epi32(e, _mm256_castps_si256(big));
+
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+	__m256 t2 = _mm256_mul_ps(t, t);
+	__m256 poly = _mm256_set1_ps(zmon_ln_c9);
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, t2), _mm256_set1_ps(zmon_ln_c7));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, t2), _mm256_set1_ps(zmon_ln_c5));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, t2), _mm256_set1_ps(zmon_ln_c3));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, t2), one);
+	__m256 ln = _mm256_mul_ps(_mm256_add_ps(t, t), poly);
+	return _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(e), _mm256_set1_ps(zmon_db_per_octave)),
+		_mm256_mul_ps(ln, _mm256_set1_ps(zmon_db_per_neper)));
+}
+
+static __m256 zmon_phase_avx2(__m256 vi, __m256 vq)
+{
+	__m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 ax = _mm256_andnot_ps(sign, vi);
+	__m256 ay = _mm256_andnot_ps(sign, vq);
+	__m256 mx = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(FLT_MIN));
+	__m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), mx);
+
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 reduce = _mm256_cmp_ps(a, _mm256_set1_ps(zmon_tan_pi_8), _CMP_GT_OQ);
+	__m256 x = _mm256_blendv_ps(a, _mm256_div_ps(_mm256_sub_ps(a, one), _mm256_add_ps(a, one)), reduce);
+	__m256 x2 = _mm256_mul_ps(x, x);
+	__m256 poly = _mm256_set1_ps(zmon_atan_c15);
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, x2), _mm256_set1_ps(zmon_atan_c13));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, x2), _mm256_set1_ps(zmon_atan_c11));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, x2), _mm256_set1_ps(zmon_atan_c9));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, x2), _mm256_set1_ps(zmon_atan_c7));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, x2), _mm256_set1_ps(zmon_atan_c5));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, x2), _mm256_set1_ps(zmon_atan_c3));
+	poly = _mm256_add_ps(_mm256_mul_ps(poly, x2), one);
+	__m256 r = _mm256_mul_ps(x, poly);
+	r = _mm256_add_ps(r, _mm256_and_ps(reduce, _mm256_set1_ps(zmon_pi_4)));
+
+	__m256 zero = _mm256_setzero_ps();
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(zmon_pi_2), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(zmon_pi), r), _mm256_cmp_ps(vi, zero, _CMP_LT_OQ));
+	r = _mm256_xor_ps(r, _mm256_and_ps(_mm256_cmp_ps(vq, zero, _CMP_LT_OQ), sign));
+	return _mm256_mul_ps(r, _mm256_set1_ps(zmon_deg_per_rad));
+}
+
+static void zmon_avx2_range(const ZmonCal *cal, const unsigned int *adcf,
+	const unsigned int *adcr, int count, ZmonResults *r)
+{
+	bool wantFloat = zmon_wants_float(r);
+	bool wantDb = r->fwdDbm || r->rflDbm || r->returnLoss;
+	__m256i fiOffset = _mm256_set1_epi32(cal->fwdIOffset);
+	__m256i fqOffset = _mm256_set1_epi32(cal->fwdQOffset);
+	__m256i riOffset = _mm256_set1_epi32(cal->rflIOffset);
+	__m256i rqOffset = _mm256_set1_epi32(cal->rflQOffset);
+	__m256i fiGain = _mm256_set1_epi32(cal->fwdIGain);
+	__m256i fqGain = _mm256_set1_epi32(cal->fwdQGain);
+	__m256i riGain = _mm256_set1_epi32(cal->rflIGain);
+	__m256i rqGain = _mm256_set1_epi32(cal->rflQGain);
+	__m256 lsb = _mm256_set1_ps(zmon_volts_lsb);
+
+	int k = 0;
+	for (; k + 8 <= count; k += 8)
+	{
+		__m256i wf = _mm256_loadu_si256((const __m256i *)(adcf + k));
+		__m256i wr = _mm256_loadu_si256((const __m256i *)(adcr + k));
+		if (r->adcf)
+			_mm256_storeu_si256((__m256i *)(r->adcf + k), _mm256_or_si256(_mm256_slli_epi32(wf, 16), _mm256_srli_epi32(wf, 16)));
+		if (r->adcr)
+			_mm256_storeu_si256((__m256i *)(r->adcr + k), _mm256_or_si256(_mm256_slli_epi32(wr, 16), _mm256_srli_epi32(wr, 16)));
+
+		__m256i fi = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_srai_epi32(wf, 16), fiOffset), fiGain);
+		__m256i fq = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_srai_epi32(_mm256_slli_epi32(wf, 16), 16), fqOffset), fqGain);
+		__m256i ri = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_srai_epi32(wr, 16), riOffset), riGain);
+		__m256i rq = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_srai_epi32(_mm256_slli_epi32(wr, 16), 16), rqOffset), rqGain);
+		if (r->fwdIVolts)
+			_mm256_storeu_si256((__m256i *)(r->fwdIVolts + k), fi);
+		if (r->fwdQVolts)
+			_mm256_storeu_si256((__m256i *)(r->fwdQVolts + k), fq);
+		if (r->rflIVolts)
+			_mm256_storeu_si256((__m256i *)(r->rflIVolts + k), ri);
+		if (r->rflQVolts)
+			_mm256_storeu_si256((__m256i *)(r->rflQVolts + k), rq);
+		if (!wantFloat)
+			continue;
+
+		__m256 vfi = _mm256_mul_ps(_mm256_cvtepi32_ps(fi), lsb);
+		__m256 vfq = _mm256_mul_ps(_mm256_cvtepi32_ps(fq), lsb);
+		__m256 vri = _mm256_mul_ps(_mm256_cvtepi32_ps(ri), lsb);
+		__m256 vrq = _mm256_mul_ps(_mm256_cvtepi32_ps(rq), lsb);
+		__m256 fsum = _mm256_add_ps(_mm256_mul_ps(vfi, vfi), _mm256_mul_ps(vfq, vfq));
+		__m256 rsum = _mm256_add_ps(_mm256_mul_ps(vri, vri), _mm256_mul_ps(vrq, vrq));
+		if (r->fwdMag)
+			_mm256_storeu_ps(r->fwdMag + k, _mm256_sqrt_ps(fsum));
+		if (r->rflMag)
+			_mm256_storeu_ps(r->rflMag + k, _mm256_sqrt_ps(rsum));
+		if (r->fwdPhase)
+			_mm256_storeu_ps(r->fwdPhase + k, zmon_phase_avx2(vfi, vfq));
+		if (r->rflPhase)
+			_mm256_storeu_ps(r->rflPhase + k, zmon_phase_avx2(vri, vrq));
+		if (wantDb)
+		{
+			__m256 fdb = zmon_db_avx2(fsum);
+			__m256 rdb = zmon_db_avx2(rsum);
+			if (r->fwdDbm)
+				_mm256_storeu_ps(r->fwdDbm + k, fdb);
+			if (r->rflDbm)
+				_mm256_storeu_ps(r->rflDbm + k, rdb);
+			if (r->returnLoss)
+				_mm256_storeu_ps(r->returnLoss + k, _mm256_sub_ps(fdb, rdb));
+		}
+	}
+	_mm256_zeroupper();
+	zmon_scalar_range(cal, adcf, adcr, k, count, r);
+}
+
+static int zmon_detect()
+{
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return zmon_sse2;
+
+	// AVX state must be enabled by the OS as well as supported by the cpu
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return zmon_sse2;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) ? zmon_avx2 : zmon_sse2;
+}
+
+/*
+	Fastest kernel this machine supports
+
+	Returns: zmon_sse2 or zmon_avx2
+*/
+DllExport int ZmonBestKernel()
+{
+	static const int best = zmon_detect();
+	return best;
+}
+
+/*
+	Convert count raw MEAS fifo words to the results requested in *results.
+	kernel is zmon_auto for the fastest available, or zmon_scalar for the
+	reference path to validate the others against.
+
+	Returns: 0 on success, else Windows error code
+*/
+DllExport int ZmonConvert(int kernel, const ZmonCal *cal, const unsigned int *adcf,
+	const unsigned int *adcr, int count, ZmonResults *results)
+{
+	DWORD err;
+
+	if (cal == NULL || adcf == NULL || adcr == NULL || results == NULL || count < 0)
+	{
+		err = 87;	// INVALID_PARAMETER
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, invalid ZMON conversion arguments.", err);
+		return err;
+	}
+
+	if (kernel == zmon_auto)
+		kernel = ZmonBestKernel();
+	switch (kernel)
+	{
+	case zmon_scalar:
+		zmon_scalar_range(cal, adcf, adcr, 0, count, results);
+		return 0;
+	case zmon_sse2:
+		zmon_sse2_range(cal, adcf, adcr, count, results);
+		return 0;
+	case zmon_avx2:
+		if (ZmonBestKernel() == zmon_avx2)
+		{
+			zmon_avx2_range(cal, adcf, adcr, count, results);
+			return 0;
+		}
+		err = ERROR_NOT_SUPPORTED;
+		_snprintf_s(_lastError, max_bytes_returned, "Error %u, AVX2 not supported on this cpu.", err);
+		return err;
+	}
+
+	err = 87;	// INVALID_PARAMETER
+	_snprintf_s(_lastError, max_bytes_returned, "Error %u, unknown ZMON kernel %d.", err, kernel);
+	return err;
+}
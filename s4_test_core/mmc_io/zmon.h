@@ -0,0 +1,64 @@
+//
+// zmon.h : Host-side ZMON/ADC conversion of raw MEAS captures.
+//
+// Mirrors the fixed-point math in meas_calcs.v so bulk raw captures can be
+// converted on the host instead of one MEAS request at a time:
+//
+//	M_ADC   = raw word with the I & Q halves swapped, no offset or gain
+//	M_VOLTS = ((sign_extend(raw) + sign_extend(offset)) * gain)[31:0], Q15.16
+//
+// The calibration offset & gain apply only to M_VOLTS. The integer outputs
+// are bit for bit what the FPGA returns for MEAS M_ADC and M_VOLTS
+// requests. Magnitude, phase, dBm and return loss are derived from the
+// M_VOLTS values in single precision with the same operation order in
+// every kernel, so the SSE2/AVX2 results also match the scalar reference
+// exactly.
+//
+#pragma once
+
+#include "mmc_io.h"
+
+// Kernel selection for ZmonConvert()
+#define zmon_auto 0
+#define zmon_scalar 1
+#define zmon_sse2 2
+#define zmon_avx2 3
+
+// ZMON calibration, same registers the CALZMON opcode loads
+typedef struct ZmonCal
+{
+	int fwdIGain;                       // Q15.16
+	int fwdQGain;
+	int rflIGain;
+	int rflQGain;
+	short fwdIOffset;                   // signed ADC lsbs
+	short fwdQOffset;
+	short rflIOffset;
+	short rflQOffset;
+} ZmonCal;
+
+// Caller-owned output arrays, count entries each. Any may be NULL to skip it.
+typedef struct ZmonResults
+{
+	unsigned int *adcf;                 // M_ADC word, [FWDQ][FWDI]
+	unsigned int *adcr;                 // M_ADC word, [RFLQ][RFLI]
+	int *fwdIVolts;                     // M_VOLTS, Q15.16
+	int *fwdQVolts;
+	int *rflIVolts;
+	int *rflQVolts;
+	float *fwdMag;                      // volts
+	float *rflMag;
+	float *fwdPhase;                    // degrees, atan2(Q, I)
+	float *rflPhase;
+	float *fwdDbm;                      // into 50 ohms
+	float *rflDbm;
+	float *returnLoss;                  // dB, fwdDbm - rflDbm
+} ZmonResults;
+
+// adcf & adcr are raw meas fifo words, [FWDI][FWDQ] & [RFLI][RFLQ]
+DllExport int ZmonConvert(int kernel, const ZmonCal *cal, const unsigned int *adcf,
+	const unsigned int *adcr, int count, ZmonResults *results);
+DllExport int ZmonBestKernel();
+
+// For the other mmc_io translation units, dBm into 50 ohms from I^2 + Q^2 volts
+float zmon_db(float sumsq);
@@ -0,0 +1,635 @@
+//
+// mmc_io_test.cpp : Native checks of the version 2 MMC ABI, and timing of
+// MmcTransfer() against the version 1 WriteMmc()/ReadMmc() pair. Also
+// checks the ZmonConvert() SSE2 & AVX2 kernels against the scalar one, and
+// round trips rows through a measurement store in the temp directory.
+//
+//	mmc_io_test                             argument checks only, no device
+//	mmc_io_test \\.\PhysicalDrive2 [cycles] also device checks & timing
+//
+// The device is opened exclusively, close the test bench first.
+// Exit code is the number of failed checks.
+//
+#include "stdafx.h"
+#include "mmc_io_v2.h"
+#include "scheduler.h"
+#include "zmon.h"
+#include "measstore.h"
+
+#include <limits.h>
+#include <math.h>
+
+#define test_block_bytes 1024               // RunCmd framing, opcodes at 512
+#define test_opcode_offset 512
+#define test_default_cycles 1000
+#define test_status_bytes 64
+#define op_status 0x01
+#define zmon_outputs 13                     // arrays in ZmonResults
+#define zmon_test_max 4099
+#define measstore_test_batch 1000           // rows per MstoreAppend() & MstoreRead()
+
+static int _failures;
+
+static void check(bool ok, const char *what, int result)
+{
+	printf("%s  %-52s %d\n", ok ? "pass" : "FAIL", what, result);
+	if (!ok)
+		++_failures;
+}
+
+static double elapsed_us(LARGE_INTEGER start, LARGE_INTEGER stop, LARGE_INTEGER frequency)
+{
+	return (double)(stop.QuadPart - start.QuadPart) * 1.0e6 / (double)frequency.QuadPart;
+}
+
+/*
+	Argument checks that need no device, every one must fail cleanly
+	with INVALID_PARAMETER or a truncated status.
+*/
+static void abi_checks()
+{
+	MmcHandle hMmc = 0;
+	MmcDeviceInfo info;
+	char status[test_status_bytes];
+	char tiny[4];
+	BYTE block[test_block_bytes];
+	int bytesRead = -1;
+	int result;
+
+	// Slot 5 of a generation never handed out, and a slot out of range
+	MmcHandle bad = 0x1234567800000005ULL;
+	MmcHandle wild = 0x00000000ffffffffULL;
+
+	memset(block, 0, sizeof(block));
+
+	result = MmcAbiVersion();
+	check(result == mmc_abi_version, "MmcAbiVersion", result);
+
+	result = MmcOpen(NULL, &hMmc);
+	check(result == 87 && hMmc == 0, "MmcOpen NULL device name", result);
+	result = MmcOpen("\\\\.\\mmc_io_test_no_such_device", NULL);
+	check(result == 87, "MmcOpen NULL handle", result);
+	result = MmcOpen("\\\\.\\mmc_io_test_no_such_device", &hMmc);
+	check(result != 0 && hMmc == 0, "MmcOpen missing device", result);
+
+	// The failed open left its reason in the global status
+	result = MmcGetStatus(0, status, sizeof(status));
+	check((result == 0 || result == ERROR_INSUFFICIENT_BUFFER) && status[0] != 0,
+		"MmcGetStatus global", result);
+	result = MmcGetStatus(0, tiny, sizeof(tiny));
+	check(result == ERROR_INSUFFICIENT_BUFFER && strlen(tiny) == sizeof(tiny) - 1,
+		"MmcGetStatus short buffer", result);
+	result = MmcGetStatus(0, NULL, sizeof(status));
+	check(result == 87, "MmcGetStatus NULL buffer", result);
+	result = MmcGetStatus(0, status, 0);
+	check(result == 87, "MmcGetStatus zero length", result);
+	result = MmcGetStatus(0, status, -1);
+	check(result == 87, "MmcGetStatus negative length", result);
+	result = MmcGetStatus(bad, status, sizeof(status));
+	check(result == 87, "MmcGetStatus bad handle", result);
+
+	info.size = sizeof(info);
+	result = MmcGetInfo(0, &info);
+	check(result == 87, "MmcGetInfo zero handle", result);
+	result = MmcGetInfo(bad, &info);
+	check(result == 87, "MmcGetInfo bad handle", result);
+	result = MmcGetInfo(wild, &info);
+	check(result == 87, "MmcGetInfo out of range handle", result);
+
+	result = MmcWrite(bad, block, test_block_bytes);
+	check(result == 87, "MmcWrite bad handle", result);
+	result = MmcRead(bad, block, test_block_bytes, &bytesRead);
+	check(result == 87, "MmcRead bad handle", result);
+	result = MmcTransfer(bad, block, test_block_bytes, block, test_block_bytes);
+	check(result == 87, "MmcTransfer bad handle", result);
+	result = MmcClose(bad);
+	check(result == 87, "MmcClose bad handle", result);
+	result = MmcClose(wild);
+	check(result == 87, "MmcClose out of range handle", result);
+	result = MmcClose(0);
+	check(result == 87, "MmcClose zero handle", result);
+}
+
+/*
+	Argument checks on an open device, then one real status transfer.
+	None of the rejected calls may reach the device.
+*/
+static void device_checks(MmcHandle hMmc, BYTE *block, BYTE *response)
+{
+	MmcDeviceInfo info;
+	char status[test_status_bytes];
+	int bytesRead = -1;
+	int result;
+
+	memset(&info, 0, sizeof(info));
+	info.size = sizeof(info) - 1;
+	result = MmcGetInfo(hMmc, &info);
+	check(result == 87, "MmcGetInfo short size", result);
+	result = MmcGetInfo(hMmc, NULL);
+	check(result == 87, "MmcGetInfo NULL info", result);
+	info.size = sizeof(info);
+	result = MmcGetInfo(hMmc, &info);
+	check(result == 0 && info.abiVersion == mmc_abi_version && info.sectorBytes == mmc_sector_bytes,
+		"MmcGetInfo", result);
+	printf("      device bytes %I64d\n", info.deviceBytes);
+
+	result = MmcWrite(hMmc, block, 0);
+	check(result == 87, "MmcWrite zero length", result);
+	result = MmcWrite(hMmc, block, mmc_sector_bytes + 1);
+	check(result == 87, "MmcWrite non-sector length", result);
+	result = MmcWrite(hMmc, NULL, mmc_sector_bytes);
+	check(result == 87, "MmcWrite NULL data", result);
+	result = MmcRead(hMmc, response, mmc_sector_bytes - 1, &bytesRead);
+	check(result == 87 && bytesRead == 0, "MmcRead non-sector length", result);
+	result = MmcRead(hMmc, NULL, mmc_sector_bytes, NULL);
+	check(result == 87, "MmcRead NULL data", result);
+	result = MmcTransfer(hMmc, block, test_block_bytes, response, 100);
+	check(result == 87, "MmcTransfer non-sector read", result);
+	result = MmcTransfer(hMmc, block, -mmc_sector_bytes, response, test_block_bytes);
+	check(result == 87, "MmcTransfer negative write", result);
+	result = MmcTransfer(hMmc, block, test_block_bytes, NULL, test_block_bytes);
+	check(result == 87, "MmcTransfer NULL response", result);
+
+	// The rejected calls set the device status, not the global one
+	result = MmcGetStatus(hMmc, status, sizeof(status));
+	check(result == 0 && strstr(status, "sector") != NULL, "MmcGetStatus device", result);
+
+	result = MmcTransfer(hMmc, block, test_block_bytes, response, test_block_bytes);
+	check(result == 0, "MmcTransfer STATUS", result);
+	MmcGetStatus(hMmc, status, sizeof(status));
+	printf("      %s\n", status);
+}
+
+/*
+	The scheduler keeps the device open, then the closed handle must be
+	rejected by every call, not dereferenced.
+*/
+static void close_checks(MmcHandle hMmc, BYTE *block, BYTE *response)
+{
+	MmcDeviceInfo info;
+	char status[test_status_bytes];
+	int result;
+
+	result = SchedStart(hMmc, (int)(8 * sizeof(DWORD_PTR)));
+	check(result == 87, "SchedStart cpu out of range", result);
+	result = SchedStart(hMmc, -1);
+	check(result == 0, "SchedStart", result);
+	if (result == 0)
+	{
+		result = MmcClose(hMmc);
+		check(result == ERROR_BUSY, "MmcClose with scheduler attached", result);
+		result = SchedStop();
+		check(result == 0, "SchedStop", result);
+	}
+
+	result = MmcClose(hMmc);
+	check(result == 0, "MmcClose", result);
+	result = MmcClose(hMmc);
+	check(result == 87, "MmcClose closed handle", result);
+	info.size = sizeof(info);
+	result = MmcGetInfo(hMmc, &info);
+	check(result == 87, "MmcGetInfo closed handle", result);
+	result = MmcTransfer(hMmc, block, test_block_bytes, response, test_block_bytes);
+	check(result == 87, "MmcTransfer closed handle", result);
+	result = MmcGetStatus(hMmc, status, sizeof(status));
+	check(result == 87, "MmcGetStatus closed handle", result);
+	result = SchedStart(hMmc, -1);
+	check(result == ERROR_INVALID_HANDLE, "SchedStart closed handle", result);
+}
+
+/*
+	Time cycles STATUS command/response cycles through each ABI.
+	The devices are opened one after the other, both open exclusively.
+*/
+static void timing(const char *deviceName, int cycles, BYTE *block, BYTE *response)
+{
+	LARGE_INTEGER frequency, start, stop;
+	MmcHandle hMmc;
+	HANDLE hDevice;
+	BYTE *data;
+	int err = 0;
+	int i;
+
+	QueryPerformanceFrequency(&frequency);
+
+	if ((err = MmcOpen(deviceName, &hMmc)) != 0)
+	{
+		check(false, "MmcOpen for timing", err);
+		return;
+	}
+	QueryPerformanceCounter(&start);
+	for (i = 0; i < cycles && err == 0; ++i)
+		err = MmcTransfer(hMmc, block, test_block_bytes, response, test_block_bytes);
+	QueryPerformanceCounter(&stop);
+	MmcClose(hMmc);
+	check(err == 0, "MmcTransfer timing", err);
+	if (err == 0)
+		printf("      v2 MmcTransfer        %8.1f us/cycle, %d cycles\n",
+			elapsed_us(start, stop, frequency) / cycles, cycles);
+
+	if ((err = OpenMmc(deviceName, &hDevice)) != 0)
+	{
+		check(false, "OpenMmc for timing", err);
+		return;
+	}
+	QueryPerformanceCounter(&start);
+	for (i = 0; i < cycles && err == 0; ++i)
+	{
+		// Same work as the managed v1 caller, including the response copy
+		if ((err = WriteMmc(hDevice, block, test_block_bytes)) != 0)
+			break;
+		data = NULL;
+		err = ReadMmc(0, &data, test_block_bytes);
+		if (data != NULL)
+		{
+			memcpy(response, data, test_block_bytes);
+			CoTaskMemFree(data);
+		}
+	}
+	QueryPerformanceCounter(&stop);
+	CloseMmc(hDevice);
+	check(err == 0, "WriteMmc/ReadMmc timing", err);
+	if (err == 0)
+		printf("      v1 WriteMmc/ReadMmc   %8.1f us/cycle, %d cycles\n",
+			elapsed_us(start, stop, frequency) / cycles, cycles);
+}
+
+// Deterministic so a failure can be reproduced
+static unsigned int _seed = 0x5eed2019;
+
+static unsigned int next_random()
+{
+	_seed = _seed * 1664525 + 1013904223;
+	return _seed;
+}
+
+/*
+	Point every ZmonResults array at its slice of outputs,
+	zmon_outputs slices of zmon_test_max entries.
+*/
+static void zmon_results(unsigned int *outputs, ZmonResults *results)
+{
+	results->adcf = outputs;
+	results->adcr = outputs + zmon_test_max;
+	results->fwdIVolts = (int *)outputs + 2 * zmon_test_max;
+	results->fwdQVolts = (int *)outputs + 3 * zmon_test_max;
+	results->rflIVolts = (int *)outputs + 4 * zmon_test_max;
+	results->rflQVolts = (int *)outputs + 5 * zmon_test_max;
+	results->fwdMag = (float *)outputs + 6 * zmon_test_max;
+	results->rflMag = (float *)outputs + 7 * zmon_test_max;
+	results->fwdPhase = (float *)outputs + 8 * zmon_test_max;
+	results->rflPhase = (float *)outputs + 9 * zmon_test_max;
+	results->fwdDbm = (float *)outputs + 10 * zmon_test_max;
+	results->rflDbm = (float *)outputs + 11 * zmon_test_max;
+	results->returnLoss = (float *)outputs + 12 * zmon_test_max;
+}
+
+/*
+	Convert random raw words with random calibration through every kernel
+	the cpu has, every output must match the scalar reference bit for bit.
+	Odd counts exercise each kernel's tail handling.
+*/
+static void zmon_checks()
+{
+	static const char *names[zmon_outputs] =
+	{
+		"adcf", "adcr", "fwdIVolts", "fwdQVolts", "rflIVolts", "rflQVolts",
+		"fwdMag", "rflMag", "fwdPhase", "rflPhase", "fwdDbm", "rflDbm", "returnLoss"
+	};
+	static const int counts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 67, 1001, zmon_test_max };
+	static const int kernels[] = { zmon_sse2, zmon_avx2 };
+	ZmonCal cal;
+	ZmonResults reference, results;
+	char what[80];
+	int best = ZmonBestKernel();
+	int result;
+	int i, c, k, f;
+
+	unsigned int *adcf = (unsigned int *)malloc(zmon_test_max * sizeof(unsigned int));
+	unsigned int *adcr = (unsigned int *)malloc(zmon_test_max * sizeof(unsigned int));
+	unsigned int *expected = (unsigned int *)calloc(zmon_outputs * zmon_test_max, sizeof(unsigned int));
+	unsigned int *actual = (unsigned int *)calloc(zmon_outputs * zmon_test_max, sizeof(unsigned int));
+	zmon_results(expected, &reference);
+	zmon_results(actual, &results);
+
+	printf("      best ZMON kernel %d, seed 0x%08x\n", best, _seed);
+	if (best != zmon_avx2)
+		printf("      no AVX2, only SSE2 checked\n");
+
+	// Full scale & sign boundary words first, then random ones
+	adcf[0] = 0x00000000; adcr[0] = 0xffffffff;
+	adcf[1] = 0x80008000; adcr[1] = 0x7fff7fff;
+	adcf[2] = 0x7fff8000; adcr[2] = 0x80007fff;
+	for (i = 3; i < zmon_test_max; ++i)
+	{
+		adcf[i] = next_random();
+		adcr[i] = next_random();
+	}
+
+	for (c = 0; c < (int)_countof(counts); ++c)
+	{
+		// Gains 0.5 to 1.5 Q15.16, offsets +-512 lsbs
+		cal.fwdIGain = 0x8000 + (next_random() >> 16);
+		cal.fwdQGain = 0x8000 + (next_random() >> 16);
+		cal.rflIGain = 0x8000 + (next_random() >> 16);
+		cal.rflQGain = 0x8000 + (next_random() >> 16);
+		cal.fwdIOffset = (short)((next_random() >> 22) - 512);
+		cal.fwdQOffset = (short)((next_random() >> 22) - 512);
+		cal.rflIOffset = (short)((next_random() >> 22) - 512);
+		cal.rflQOffset = (short)((next_random() >> 22) - 512);
+
+		result = ZmonConvert(zmon_scalar, &cal, adcf, adcr, counts[c], &reference);
+		if (result != 0)
+		{
+			_snprintf_s(what, sizeof(what), "ZmonConvert scalar, %d words", counts[c]);
+			check(false, what, result);
+			continue;
+		}
+
+		for (k = 0; k < (int)_countof(kernels); ++k)
+		{
+			if (kernels[k] == zmon_avx2 && best != zmon_avx2)
+				continue;
+			memset(actual, 0xcd, zmon_outputs * zmon_test_max * sizeof(unsigned int));
+			result = ZmonConvert(kernels[k], &cal, adcf, adcr, counts[c], &results);
+			for (f = 0; f < zmon_outputs && result == 0; ++f)
+			{
+				if (memcmp(expected + f * zmon_test_max, actual + f * zmon_test_max,
+					counts[c] * sizeof(unsigned int)) != 0)
+					break;
+			}
+			_snprintf_s(what, sizeof(what), "ZmonConvert %s, %d words%s%s",
+				kernels[k] == zmon_avx2 ? "AVX2" : "SSE2", counts[c],
+				f < zmon_outputs ? ", mismatch in " : "", f < zmon_outputs ? names[f] : "");
+			check(result == 0 && f == zmon_outputs, what, result);
+		}
+	}
+
+	result = ZmonConvert(zmon_scalar, &cal, adcf, adcr, -1, &reference);
+	check(result == 87, "ZmonConvert negative count", result);
+	result = ZmonConvert(zmon_scalar, &cal, NULL, adcr, 1, &reference);
+	check(result == 87, "ZmonConvert NULL words", result);
+	result = ZmonConvert(zmon_avx2 + 1, &cal, adcf, adcr, 1, &reference);
+	check(result == 87, "ZmonConvert unknown kernel", result);
+	if (best != zmon_avx2)
+	{
+		result = ZmonConvert(zmon_avx2, &cal, adcf, adcr, 1, &results);
+		check(result == ERROR_NOT_SUPPORTED, "ZmonConvert AVX2 unsupported", result);
+	}
+
+	free(actual);
+	free(expected);
+	free(adcr);
+	free(adcf);
+}
+
+/*
+	Rows for the measurement store, every column moving both ways with
+	some deltas far past a varint byte or two. Timestamps only go forward,
+	with a big jump every few hundred rows.
+*/
+static void measstore_rows(MeasRecord *rows, int count, long long timestamp)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		timestamp += 1 + next_random() % 1000;
+		if (i % 397 == 396)
+			timestamp += 1LL << 36;
+		rows[i].timestamp = timestamp;
+		rows[i].fwdI = (short)next_random();
+		rows[i].fwdQ = (short)(next_random() >> 16);
+		rows[i].rflI = (short)((next_random() >> 24) - 128);
+		rows[i].rflQ = (short)(i & 1 ? -32768 : 32767);
+		rows[i].fwdIVolts = (int)next_random();
+		rows[i].fwdQVolts = i & 1 ? INT_MIN : INT_MAX;
+		rows[i].rflIVolts = (int)(next_random() >> 8) - 0x800000;
+		rows[i].rflQVolts = -i * 1000;
+		rows[i].fwdDbm = (short)((next_random() >> 20) - 2048);
+		rows[i].rflDbm = (short)(-i);
+		rows[i].temperature = (short)(0x1900 + (next_random() >> 28));
+		rows[i].reserved = 0;
+		rows[i].alarms = i % 11 == 0 ? 0xffffffff : next_random() & 0x0f;
+	}
+}
+
+static long long measstore_column(const MeasRecord *r, int column)
+{
+	switch (column)
+	{
+	case mcol_timestamp:	return r->timestamp;
+	case mcol_fwdI:			return r->fwdI;
+	case mcol_fwdQ:			return r->fwdQ;
+	case mcol_rflI:			return r->rflI;
+	case mcol_rflQ:			return r->rflQ;
+	case mcol_fwdIVolts:	return r->fwdIVolts;
+	case mcol_fwdQVolts:	return r->fwdQVolts;
+	case mcol_rflIVolts:	return r->rflIVolts;
+	case mcol_rflQVolts:	return r->rflQVolts;
+	case mcol_fwdDbm:		return r->fwdDbm;
+	case mcol_rflDbm:		return r->rflDbm;
+	case mcol_temperature:	return r->temperature;
+	case mcol_alarms:		return r->alarms;
+	}
+	return 0;
+}
+
+static bool measstore_same(const MeasRecord *a, const MeasRecord *b)
+{
+	for (int c = 0; c < mcol_count; ++c)
+	{
+		if (measstore_column(a, c) != measstore_column(b, c))
+			return false;
+	}
+	return true;
+}
+
+/*
+	Read tStart to tEnd back a few rows at a time, so the cursor carries
+	across calls & chunk boundaries, and compare with the rows written.
+*/
+static void measstore_read_check(HANDLE hReader, const MeasRecord *rows, int total,
+	long long tStart, long long tEnd, const char *what)
+{
+	MeasRecord records[measstore_test_batch];
+	MeasCursor cursor;
+	char text[80];
+	int count, calls = 0, mismatched = 0;
+	int result;
+
+	// Timestamps only go forward, the range is one run of rows
+	int first = 0;
+	while (first < total && rows[first].timestamp < tStart)
+		++first;
+	int last = first;
+	while (last < total && rows[last].timestamp <= tEnd)
+		++last;
+
+	int next = first;
+	memset(&cursor, 0, sizeof(cursor));
+	do
+	{
+		result = MstoreRead(hReader, tStart, tEnd, records, _countof(records), &count, &cursor);
+		for (int i = 0; i < count && result == 0; ++i, ++next)
+		{
+			if (next >= last || !measstore_same(&records[i], &rows[next]))
+				++mismatched;
+		}
+		++calls;
+	} while (result == 0 && count > 0);
+
+	_snprintf_s(text, sizeof(text), "MstoreRead %s, %d rows in %d calls", what, next - first, calls);
+	check(result == 0 && mismatched == 0 && next == last && calls > 2, text, result);
+}
+
+/*
+	Aggregate every column over tStart to tEnd and compare with the same
+	sums taken over the rows written.
+*/
+static void measstore_aggregate_check(HANDLE hReader, const MeasRecord *rows, int total,
+	long long tStart, long long tEnd, const char *what)
+{
+	MeasAggregate aggregate;
+	char text[80];
+	int result;
+
+	for (int c = 0; c < mcol_count; ++c)
+	{
+		long long count = 0, minValue = 0, maxValue = 0, sum = 0;
+		for (int i = 0; i < total; ++i)
+		{
+			if (rows[i].timestamp < tStart || rows[i].timestamp > tEnd)
+				continue;
+			long long value = measstore_column(&rows[i], c);
+			if (count == 0 || value < minValue)
+				minValue = value;
+			if (count == 0 || value > maxValue)
+				maxValue = value;
+			sum += value;
+			++count;
+		}
+		double mean = count > 0 ? (double)sum / count : 0.0;
+
+		result = MstoreAggregate(hReader, tStart, tEnd, c, &aggregate);
+		_snprintf_s(text, sizeof(text), "MstoreAggregate %s, column %d", what, c);
+		check(result == 0 && count > 0 && aggregate.count == count &&
+			aggregate.minValue == minValue && aggregate.maxValue == maxValue &&
+			fabs(aggregate.mean - mean) <= fabs(mean) * 1.0e-9, text, result);
+	}
+}
+
+/*
+	Write a store in two sessions, read it back & aggregate it.
+	The first session leaves a part chunk, the second appends after it,
+	so the store is chunks of 4096, 4096, 123, 4096 & 77 rows.
+*/
+static void measstore_checks()
+{
+	static const int appended[] = { 2 * measstore_chunk_rows + 123, measstore_chunk_rows + 77 };
+	char directory[MAX_PATH], path[MAX_PATH];
+	MeasStoreInfo info;
+	HANDLE hStore, hReader, unused;
+	int total = appended[0] + appended[1];
+	int result;
+
+	result = MstoreOpen(NULL, 0, &unused);
+	check(result == 87, "MstoreOpen NULL path", result);
+	result = MstoreOpenRead("unused", NULL);
+	check(result == 87, "MstoreOpenRead NULL handle", result);
+
+	if (GetTempPath(sizeof(directory), directory) == 0 || GetTempFileName(directory, "mst", 0, path) == 0)
+	{
+		check(false, "GetTempFileName for measurement store", GetLastError());
+		return;
+	}
+
+	MeasRecord *rows = (MeasRecord *)malloc(total * sizeof(MeasRecord));
+	measstore_rows(rows, appended[0], 1LL << 42);
+	measstore_rows(rows + appended[0], appended[1], rows[appended[0] - 1].timestamp);
+
+	int first = 0;
+	for (int session = 0; session < (int)_countof(appended); ++session)
+	{
+		result = MstoreOpen(path, 0, &hStore);
+		check(result == 0, "MstoreOpen", result);
+		if (result != 0)
+			break;
+		for (int i = 0; i < appended[session] && result == 0; i += measstore_test_batch)
+		{
+			int count = appended[session] - i < measstore_test_batch ? appended[session] - i : measstore_test_batch;
+			result = MstoreAppend(hStore, rows + first + i, count);
+		}
+		check(result == 0, "MstoreAppend", result);
+		result = MstoreClose(hStore);
+		check(result == 0, "MstoreClose", result);
+		first += appended[session];
+	}
+
+	result = MstoreOpenRead(path, &hReader);
+	check(result == 0, "MstoreOpenRead", result);
+	if (result == 0)
+	{
+		result = MstoreInfo(hReader, &info);
+		check(result == 0 && info.rows == total && info.chunks == 5 &&
+			info.firstTimestamp == rows[0].timestamp &&
+			info.lastTimestamp == rows[total - 1].timestamp, "MstoreInfo", (int)info.rows);
+
+		// From inside the 1st chunk, across the 1st session's part chunk,
+		// to inside the 2nd session's first
+		measstore_read_check(hReader, rows, total,
+			rows[1000].timestamp, rows[appended[0] + 1000].timestamp, "across sessions");
+
+		// Whole store from chunk headers, 2nd chunk only from its header,
+		// then the same rows less one at each end, decoded
+		measstore_aggregate_check(hReader, rows, total,
+			LLONG_MIN, LLONG_MAX, "all chunks inside");
+		measstore_aggregate_check(hReader, rows, total,
+			rows[measstore_chunk_rows].timestamp, rows[2 * measstore_chunk_rows - 1].timestamp, "one chunk inside");
+		measstore_aggregate_check(hReader, rows, total,
+			rows[measstore_chunk_rows + 1].timestamp, rows[2 * measstore_chunk_rows - 2].timestamp, "one chunk straddled");
+		measstore_aggregate_check(hReader, rows, total,
+			rows[100].timestamp, rows[total - 10].timestamp, "inside & straddled");
+
+		result = MstoreCloseRead(hReader);
+		check(result == 0, "MstoreCloseRead", result);
+	}
+
+	free(rows);
+	DeleteFile(path);
+}
+
+int main(int argc, char *argv[])
+{
+	abi_checks();
+	zmon_checks();
+	measstore_checks();
+
+	if (argc > 1)
+	{
+		MmcHandle hMmc;
+		int cycles = argc > 2 ? atoi(argv[2]) : test_default_cycles;
+		if (cycles <= 0)
+			cycles = test_default_cycles;
+
+		// FILE_FLAG_NO_BUFFERING wants sector aligned buffers
+		BYTE *block = (BYTE *)_aligned_malloc(test_block_bytes, mmc_sector_bytes);
+		BYTE *response = (BYTE *)_aligned_malloc(test_block_bytes, mmc_sector_bytes);
+		memset(block, 0, test_block_bytes);
+		block[test_opcode_offset] = 0;          // (op << 9) | length, little endian
+		block[test_opcode_offset + 1] = op_status << 1;
+
+		int err = MmcOpen(argv[1], &hMmc);
+		check(err == 0, "MmcOpen", err);
+		if (err == 0)
+		{
+			device_checks(hMmc, block, response);
+			close_checks(hMmc, block, response);
+			timing(argv[1], cycles, block, response);
+		}
+
+		_aligned_free(response);
+		_aligned_free(block);
+	}
+
+	printf("%d failed\n", _failures);
+	return _failures;
+}